@@ -26,7 +26,7 @@ int main()
         printf("%c, ", data[i]);
     }
 
-    int success = SolitaireSort(((card_t **)(&data)), numItems);
+    int success = SolitaireSortWithOptions(data, numItems, NULL);
 
     puts("Sorted");
     for (int i = 0; i < numItems; ++i)
@@ -0,0 +1,568 @@
+/**
+ * @file solitaire-sort-cli.c
+ * @brief Sorts the bytes of whole files in place by playing Solitaire with them.
+ *
+ * Each file is mapped into memory and the mapping handed straight to SolitaireSortWithOptions, so on one thread
+ * the foundation is built in the page cache itself and nothing goes through stdio.
+ *
+ * Usage: solitaire-sort-cli [-t threads] [-r retries] [-s seed] [-b] [-w weights] [-e trace] [-c catalog] path...
+ *        solitaire-sort-cli -d trace
+ * A directory sorts every regular file directly inside it.
+ * -e keeps the latest moves of every thread in memory and dumps them to (trace) once everything is sorted, and -d reads that back as text.
+ * -w scores moves with weights read from a file, like the ones solitaire-sort-bench --tune prints, for every path after it.
+ * -c loads the winning games of earlier runs from (catalog), if it is there, and saves them back with this run's at the end,
+ * so files that come round again with the same contents are sorted by replaying a game rather than playing one.
+ */
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "solitaire-sort.h"
+
+// Constants
+enum
+{
+    TRACE_EVENTS_PER_THREAD = 1 << 16,
+    CATALOG_CAPACITY = 1 << 12,
+};
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * A whole file mapped read-write.
+ */
+typedef struct
+{
+    card_t *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+
+} MappedFile;
+
+#ifdef _WIN32
+
+int MapFile(const char *path, MappedFile *file)
+{
+    file->data = NULL;
+    file->size = 0;
+    file->mapping = NULL;
+    file->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file->file == INVALID_HANDLE_VALUE)
+    {
+        return 1;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file->file, &size))
+    {
+        CloseHandle(file->file);
+        return 1;
+    }
+    file->size = (size_t)size.QuadPart;
+    if (file->size == 0)
+    {
+        return 0; // Nothing to map, and nothing to sort.
+    }
+
+    file->mapping = CreateFileMappingA(file->file, NULL, PAGE_READWRITE, 0, 0, NULL);
+    file->data = file->mapping ? (card_t *)MapViewOfFile(file->mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0) : NULL;
+    if (!file->data)
+    {
+        if (file->mapping)
+        {
+            CloseHandle(file->mapping);
+        }
+        CloseHandle(file->file);
+        return 1;
+    }
+    return 0;
+}
+
+int SyncFile(MappedFile *file)
+{
+    return (file->size == 0 || (FlushViewOfFile(file->data, 0) && FlushFileBuffers(file->file))) ? 0 : 1;
+}
+
+void UnmapFile(MappedFile *file)
+{
+    if (file->data)
+    {
+        UnmapViewOfFile(file->data);
+        CloseHandle(file->mapping);
+    }
+    CloseHandle(file->file);
+}
+
+int IsDirectory(const char *path)
+{
+    const DWORD attributes = GetFileAttributesA(path);
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+#else
+
+int MapFile(const char *path, MappedFile *file)
+{
+    file->data = NULL;
+    file->size = 0;
+    file->fd = open(path, O_RDWR);
+    if (file->fd < 0)
+    {
+        return 1;
+    }
+
+    struct stat info;
+    if (fstat(file->fd, &info) != 0)
+    {
+        close(file->fd);
+        return 1;
+    }
+    file->size = (size_t)info.st_size;
+    if (file->size == 0)
+    {
+        return 0; // Nothing to map, and nothing to sort.
+    }
+
+    void *data = mmap(NULL, file->size, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+    if (data == MAP_FAILED)
+    {
+        close(file->fd);
+        return 1;
+    }
+    file->data = (card_t *)data;
+    return 0;
+}
+
+int SyncFile(MappedFile *file)
+{
+    return (file->size == 0 || msync(file->data, file->size, MS_SYNC) == 0) ? 0 : 1;
+}
+
+void UnmapFile(MappedFile *file)
+{
+    if (file->data)
+    {
+        munmap(file->data, file->size);
+    }
+    close(file->fd);
+}
+
+int IsDirectory(const char *path)
+{
+    struct stat info;
+    return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+#endif
+
+double NowMilliseconds(void)
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1000000.0;
+}
+
+/**
+ * Sorts one file in place and says how it went.
+ * @return 0 if the file is now sorted.
+ */
+int SortFile(const char *path, const SolitaireSortOptions *options)
+{
+    MappedFile file;
+    if (MapFile(path, &file) != 0)
+    {
+        fprintf(stderr, "%s: couldn't map\n", path);
+        return 1;
+    }
+
+    const double start = NowMilliseconds();
+    int result = file.size == 0 ? 0 : SolitaireSortWithOptions(file.data, file.size, options);
+    const double elapsed = NowMilliseconds() - start;
+
+    if (SyncFile(&file) != 0)
+    {
+        fprintf(stderr, "%s: couldn't write back\n", path);
+        result = 1;
+    }
+    else if (result != 0)
+    {
+        // A lost sort still leaves every byte in the file, just not in order.
+        fprintf(stderr, "%s: lost every game\n", path);
+    }
+    else
+    {
+        printf("%s: %lu bytes in %.3f ms\n", path, (unsigned long)file.size, elapsed);
+    }
+
+    UnmapFile(&file);
+    return result;
+}
+
+/**
+ * Sorts every regular file directly inside a directory. Subdirectories are left alone.
+ * @return 0 if every file is now sorted.
+ */
+int SortDirectory(const char *path, const SolitaireSortOptions *options)
+{
+    int result = 0;
+    const size_t pathLength = strlen(path);
+#ifdef _WIN32
+    char *pattern = (char *)malloc(pathLength + 3);
+    if (!pattern)
+    {
+        return 1;
+    }
+    memcpy(pattern, path, pathLength);
+    memcpy(pattern + pathLength, "\\*", 3);
+
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA(pattern, &entry);
+    free(pattern);
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "%s: couldn't open\n", path);
+        return 1;
+    }
+    do
+    {
+        const char *name = entry.cFileName;
+        if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            continue;
+        }
+#else
+    DIR *dir = opendir(path);
+    if (!dir)
+    {
+        fprintf(stderr, "%s: couldn't open\n", path);
+        return 1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        const char *name = entry->d_name;
+#endif
+        const size_t nameLength = strlen(name);
+        char *child = (char *)malloc(pathLength + nameLength + 2);
+        if (!child)
+        {
+            result = 1;
+            break;
+        }
+        memcpy(child, path, pathLength);
+        child[pathLength] = '/';
+        memcpy(child + pathLength + 1, name, nameLength + 1);
+
+        if (!IsDirectory(child))
+        {
+            result |= SortFile(child, options);
+        }
+        free(child);
+#ifdef _WIN32
+    } while (FindNextFileA(find, &entry));
+    FindClose(find);
+#else
+    }
+    closedir(dir);
+#endif
+    return result;
+}
+
+void PrintUsage(void)
+{
+    fputs("Usage: solitaire-sort-cli [-t threads] [-r retries] [-s seed] [-b] [-w weights] [-e trace] [-c catalog] path...\n"
+          "       solitaire-sort-cli -d trace\n"
+          "Sorts the bytes of each file in place. A directory sorts every file directly inside it.\n"
+          "  -t  Games to play at once (default 1, which sorts in place with no copy)\n"
+          "  -r  Games to try before giving up on a file (default 3)\n"
+          "  -s  Seed, for reproducible runs (default time-based)\n"
+          "  -b  Counting mode, for files over few distinct bytes\n"
+          "  -w  Score moves with the weights in this file, as printed by solitaire-sort-bench --tune\n"
+          "  -e  Record each thread's latest moves and dump them to this file at the end\n"
+          "  -c  Replay the games that won files with the same contents before, kept in this file, and add this run's\n"
+          "  -d  Print a dump made with -e as text, instead of sorting anything\n",
+          stderr);
+}
+
+/**
+ * Prints a dump made with -e.
+ * @return 0 if the whole dump was read.
+ */
+int DecodeTrace(const char *path)
+{
+    FILE *input = fopen(path, "rb");
+    if (!input)
+    {
+        fprintf(stderr, "%s: couldn't open\n", path);
+        return 1;
+    }
+    const int result = SolitaireSortPrintTrace(input, stdout);
+    fclose(input);
+    if (result != 0)
+    {
+        fprintf(stderr, "%s: not a whole trace\n", path);
+    }
+    return result;
+}
+
+/**
+ * Rings for every thread, sized once the thread count is known.
+ * @return NULL if there wasn't the memory.
+ */
+SolitaireSortTrace *ConstructTraces(size_t numThreads)
+{
+    SolitaireSortTrace *traces = (SolitaireSortTrace *)calloc(numThreads, sizeof(SolitaireSortTrace));
+    SolitaireSortEvent *events = (SolitaireSortEvent *)malloc(numThreads * TRACE_EVENTS_PER_THREAD * sizeof(SolitaireSortEvent));
+    if (!traces || !events)
+    {
+        free(traces);
+        free(events);
+        return NULL;
+    }
+    for (size_t i = 0; i < numThreads; ++i)
+    {
+        traces[i].events = events + i * TRACE_EVENTS_PER_THREAD;
+        traces[i].capacity = TRACE_EVENTS_PER_THREAD;
+    }
+    return traces;
+}
+
+void DestructTraces(SolitaireSortTrace *traces)
+{
+    if (traces)
+    {
+        free(traces[0].events);
+        free(traces);
+    }
+}
+
+/**
+ * Reads a weights file over the defaults.
+ * @return 0 if the whole file was read.
+ */
+int LoadWeights(const char *path, SolitaireSortWeights *weights)
+{
+    FILE *input = fopen(path, "r");
+    if (!input)
+    {
+        fprintf(stderr, "%s: couldn't open\n", path);
+        return 1;
+    }
+    *weights = SolitaireSortDefaultWeights();
+    const int result = SolitaireSortReadWeights(weights, input);
+    fclose(input);
+    if (result != 0)
+    {
+        fprintf(stderr, "%s: not a weights file\n", path);
+    }
+    return result;
+}
+
+/**
+ * A catalog holding whatever an earlier run saved to (path). A missing file just means an empty catalog.
+ * @return NULL if there wasn't the memory.
+ */
+SolitaireSortCatalog *OpenCatalog(const char *path)
+{
+    SolitaireSortCatalog *catalog = SolitaireSortCreateCatalog(CATALOG_CAPACITY);
+    FILE *input = catalog ? fopen(path, "rb") : NULL;
+    if (input)
+    {
+        if (SolitaireSortLoadCatalog(catalog, input) != 0)
+        {
+            fprintf(stderr, "%s: not a whole catalog, keeping what could be read\n", path);
+        }
+        fclose(input);
+    }
+    return catalog;
+}
+
+/**
+ * @return 0 if the whole catalog was written.
+ */
+int SaveCatalog(const char *path, const SolitaireSortCatalog *catalog)
+{
+    FILE *output = fopen(path, "wb");
+    if (!output)
+    {
+        fprintf(stderr, "%s: couldn't open\n", path);
+        return 1;
+    }
+    int result = SolitaireSortSaveCatalog(catalog, output);
+    result |= fclose(output) != 0;
+    if (result != 0)
+    {
+        fprintf(stderr, "%s: couldn't write\n", path);
+    }
+    return result;
+}
+
+/**
+ * Dumps every thread's ring, one after another.
+ * @return 0 if they were all written.
+ */
+int WriteTraces(const char *path, const SolitaireSortTrace traces[], size_t numThreads)
+{
+    FILE *output = fopen(path, "wb");
+    if (!output)
+    {
+        fprintf(stderr, "%s: couldn't open\n", path);
+        return 1;
+    }
+    int result = 0;
+    for (size_t i = 0; i < numThreads; ++i)
+    {
+        result |= SolitaireSortWriteTrace(&traces[i], output);
+    }
+    result |= fclose(output) != 0;
+    if (result != 0)
+    {
+        fprintf(stderr, "%s: couldn't write\n", path);
+    }
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    SolitaireSortOptions options;
+    memset(&options, 0, sizeof(options));
+
+    int numPaths = 0;
+    int result = 0;
+    const char *tracePath = NULL;
+    SolitaireSortTrace *traces = NULL;
+    const char *catalogPath = NULL;
+    SolitaireSortWeights weights;
+    size_t numTraces = 1;
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        // -t can change between paths, so every thread count asked for needs its own ring.
+        if (strcmp(argv[i], "-t") == 0)
+        {
+            const size_t numThreads = (size_t)strtoull(argv[i + 1], NULL, 10);
+            numTraces = numThreads > numTraces ? numThreads : numTraces;
+        }
+    }
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        if (arg[0] == '-' && arg[1] != '\0' && arg[2] == '\0')
+        {
+            if (arg[1] == 'b')
+            {
+                options.flags |= SOLITAIRE_SORT_BULK_FOUNDATION;
+                continue;
+            }
+            if (i + 1 == argc || !strchr("trsedcw", arg[1]))
+            {
+                PrintUsage();
+                result = 2;
+                goto cleanup;
+            }
+            if (arg[1] == 'e')
+            {
+                tracePath = argv[++i];
+                continue;
+            }
+            if (arg[1] == 'c')
+            {
+                catalogPath = argv[++i];
+                continue;
+            }
+            if (arg[1] == 'w')
+            {
+                if (LoadWeights(argv[++i], &weights) != 0)
+                {
+                    result = 1;
+                    goto cleanup;
+                }
+                options.weights = &weights;
+                continue;
+            }
+            if (arg[1] == 'd')
+            {
+                ++numPaths;
+                result |= DecodeTrace(argv[++i]);
+                continue;
+            }
+            const unsigned long long value = strtoull(argv[++i], NULL, 10);
+            switch (arg[1])
+            {
+            case 't':
+                options.numThreads = (size_t)value;
+                break;
+            case 'r':
+                options.maxRetries = (size_t)value;
+                break;
+            case 's':
+                options.seed = (uint64_t)value;
+                break;
+            }
+            continue;
+        }
+
+        if (tracePath && !traces)
+        {
+            traces = ConstructTraces(numTraces);
+            if (!traces)
+            {
+                fputs("couldn't allocate the trace\n", stderr);
+                result = 1;
+                goto cleanup;
+            }
+            options.traces = traces;
+        }
+        if (catalogPath && !options.catalog)
+        {
+            options.catalog = OpenCatalog(catalogPath);
+            if (!options.catalog)
+            {
+                fputs("couldn't allocate the catalog\n", stderr);
+                result = 1;
+                goto cleanup;
+            }
+        }
+
+        ++numPaths;
+        result |= IsDirectory(arg) ? SortDirectory(arg, &options) : SortFile(arg, &options);
+    }
+
+    if (traces)
+    {
+        result |= WriteTraces(tracePath, traces, numTraces);
+    }
+    if (options.catalog)
+    {
+        result |= SaveCatalog(catalogPath, options.catalog);
+    }
+    if (numPaths == 0)
+    {
+        PrintUsage();
+        result = 2;
+    }
+
+// Every way out frees whatever got set up, so a failure halfway through leaks nothing.
+cleanup:
+    DestructTraces(traces);
+    SolitaireSortDestroyCatalog(options.catalog);
+    return result;
+}
@@ -0,0 +1,176 @@
+/**
+ * @file solitaire-sort-threads.h
+ * @brief Just enough threads, locks and atomics for solitaire-sort.c to run games in parallel, on Windows and on pthreads.
+ *
+ * Everything here is static inline so the header can be dropped in without another translation unit.
+ */
+
+#ifndef SOLITAIRE_SORT_THREADS
+#define SOLITAIRE_SORT_THREADS
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+typedef HANDLE Thread;
+typedef volatile LONG AtomicInt;
+typedef SRWLOCK Mutex;
+typedef CONDITION_VARIABLE Condition;
+
+/** Static initializers, so a lock can be used before anything has had the chance to set it up. */
+#define MUTEX_INIT SRWLOCK_INIT
+#define CONDITION_INIT CONDITION_VARIABLE_INIT
+
+/** Declares a function that can be passed to ThreadStart. */
+#define THREAD_PROC(name) DWORD WINAPI name(LPVOID arg)
+#define THREAD_RETURN return 0
+
+static inline int ThreadStart(Thread *thread, LPTHREAD_START_ROUTINE proc, void *arg)
+{
+    *thread = CreateThread(NULL, 0, proc, arg, 0, NULL);
+    return *thread ? 0 : 1;
+}
+
+static inline void ThreadJoin(Thread *thread)
+{
+    WaitForSingleObject(*thread, INFINITE);
+    CloseHandle(*thread);
+}
+
+/** Lets the thread run on without anyone joining it. */
+static inline void ThreadDetach(Thread *thread)
+{
+    CloseHandle(*thread);
+}
+
+static inline void MutexLock(Mutex *mutex)
+{
+    AcquireSRWLockExclusive(mutex);
+}
+
+static inline void MutexUnlock(Mutex *mutex)
+{
+    ReleaseSRWLockExclusive(mutex);
+}
+
+/** Unlocks (mutex) while it waits and locks it again before returning. Can wake up for no reason, so check what was waited for. */
+static inline void ConditionWait(Condition *condition, Mutex *mutex)
+{
+    SleepConditionVariableSRW(condition, mutex, INFINITE, 0);
+}
+
+static inline void ConditionSignal(Condition *condition)
+{
+    WakeConditionVariable(condition);
+}
+
+static inline void ConditionBroadcast(Condition *condition)
+{
+    WakeAllConditionVariable(condition);
+}
+
+static inline long AtomicLoad(AtomicInt *value)
+{
+    return InterlockedCompareExchange(value, 0, 0);
+}
+
+static inline void AtomicStore(AtomicInt *value, long desired)
+{
+    InterlockedExchange(value, desired);
+}
+
+/** Returns the value from before the add. */
+static inline long AtomicFetchAdd(AtomicInt *value, long amount)
+{
+    return InterlockedExchangeAdd(value, amount);
+}
+
+/** Treat output as boolean */
+static inline int AtomicCompareExchange(AtomicInt *value, long expected, long desired)
+{
+    return InterlockedCompareExchange(value, desired, expected) == expected;
+}
+
+#else
+#include <pthread.h>
+
+typedef pthread_t Thread;
+typedef volatile long AtomicInt;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Condition;
+
+/** Static initializers, so a lock can be used before anything has had the chance to set it up. */
+#define MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#define CONDITION_INIT PTHREAD_COND_INITIALIZER
+
+/** Declares a function that can be passed to ThreadStart. */
+#define THREAD_PROC(name) void *name(void *arg)
+#define THREAD_RETURN return NULL
+
+static inline int ThreadStart(Thread *thread, void *(*proc)(void *), void *arg)
+{
+    return pthread_create(thread, NULL, proc, arg) == 0 ? 0 : 1;
+}
+
+static inline void ThreadJoin(Thread *thread)
+{
+    pthread_join(*thread, NULL);
+}
+
+/** Lets the thread run on without anyone joining it. */
+static inline void ThreadDetach(Thread *thread)
+{
+    pthread_detach(*thread);
+}
+
+static inline void MutexLock(Mutex *mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+static inline void MutexUnlock(Mutex *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+/** Unlocks (mutex) while it waits and locks it again before returning. Can wake up for no reason, so check what was waited for. */
+static inline void ConditionWait(Condition *condition, Mutex *mutex)
+{
+    pthread_cond_wait(condition, mutex);
+}
+
+static inline void ConditionSignal(Condition *condition)
+{
+    pthread_cond_signal(condition);
+}
+
+static inline void ConditionBroadcast(Condition *condition)
+{
+    pthread_cond_broadcast(condition);
+}
+
+static inline long AtomicLoad(AtomicInt *value)
+{
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static inline void AtomicStore(AtomicInt *value, long desired)
+{
+    __atomic_store_n(value, desired, __ATOMIC_RELEASE);
+}
+
+/** Returns the value from before the add. */
+static inline long AtomicFetchAdd(AtomicInt *value, long amount)
+{
+    return __atomic_fetch_add(value, amount, __ATOMIC_ACQ_REL);
+}
+
+/** Treat output as boolean */
+static inline int AtomicCompareExchange(AtomicInt *value, long expected, long desired)
+{
+    return __atomic_compare_exchange_n(value, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+#endif
+
+#endif
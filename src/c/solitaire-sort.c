@@ -13,18 +13,187 @@
 // I know the parameter orders are a bit unorthodox, I wanted to make sure SAL was able to access the size parameters.
 
 #include <time.h>
+#ifdef _MSC_VER
 #include <sal.h>
+#elif defined(__has_include)
+#if __has_include(<sal.h>)
+#include <sal.h>
+#endif
+#endif
+#include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "solitaire-sort-threads.h"
 #include "solitaire-sort.h"
 
-int RandBetween(
-    int min,
-    int max)
+#ifndef _In_
+// SAL only means anything to the MSVC analyzer, so elsewhere the annotations compile away.
+#define _Field_range_(min, max)
+#define _Field_size_(size)
+#define _In_
+#define _In_opt_
+#define _In_reads_(size)
+#define _In_reads_opt_(size)
+#define _In_z_
+#define _Inout_
+#define _Inout_opt_
+#define _Inout_updates_(size)
+#define _Inout_updates_all_(size)
+#define _Inout_updates_bytes_all_(size)
+#define _Inout_updates_opt_(size)
+#define _Out_
+#define _Out_writes_(size)
+#define _Out_writes_all_(size)
+#define _Out_writes_opt_(size)
+#define _Ret_maybenull_
+#define _Success_(expr)
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SOLITAIRE_SORT_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SOLITAIRE_SORT_TARGET_AVX2
+#else
+#define SOLITAIRE_SORT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define SOLITAIRE_SORT_X86 0
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define SOLITAIRE_SORT_NEON 1
+#include <arm_neon.h>
+#else
+#define SOLITAIRE_SORT_NEON 0
+#endif
+
+/**
+ * Build with this defined to 1 to fill in SolitaireSortCounters. Left at 0, every COUNT_EVENT compiles away to nothing,
+ * amount and all, so don't count anything with side effects.
+ */
+#ifndef SOLITAIRE_SORT_COUNTERS
+#define SOLITAIRE_SORT_COUNTERS 0
+#endif
+
+#if SOLITAIRE_SORT_COUNTERS
+#define COUNT_EVENT(board, counter, amount) ((board)->counters.counter += (uint64_t)(amount))
+#else
+#define COUNT_EVENT(board, counter, amount) ((void)0)
+#endif
+
+/**
+ * Per-game random number generator (xoshiro256**).
+ * Each Board owns one, so parallel games never contend on libc's rand() and any game can be replayed from its seed.
+ */
+typedef struct
+{
+    uint64_t s[4];
+
+} Rng;
+
+uint64_t SplitMix64(
+    _Inout_ uint64_t *x)
+{
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Seeds the generator for one particular game. The same (seed, game) pair always deals the same shuffle.
+ */
+void SeedRng(
+    _Out_ Rng *rng,
+    const uint64_t seed,
+    const uint64_t game)
+{
+    uint64_t g = game;
+    uint64_t x = seed ^ SplitMix64(&g);
+    for (size_t i = 0; i < 4; ++i)
+    {
+        rng->s[i] = SplitMix64(&x);
+    }
+}
+
+uint64_t RotateLeft(
+    const uint64_t x,
+    const int k)
 {
-    int result = rand() * (max - min) + min;
+    return (x << k) | (x >> (64 - k));
+}
+
+uint64_t NextRandom(
+    _Inout_ Rng *rng)
+{
+    uint64_t *s = rng->s;
+    const uint64_t result = RotateLeft(s[1] * 5, 7) * 9;
+    const uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = RotateLeft(s[3], 45);
     return result;
 }
 
+/**
+ * Uniform draw from [min, max], both inclusive. Rejects the few values that would bias the modulo.
+ */
+size_t RandBetween(
+    _Inout_ Rng *rng,
+    const size_t min,
+    const size_t max)
+{
+    const uint64_t range = (uint64_t)(max - min) + 1;
+    if (range == 0) // The whole 64-bit range
+    {
+        return (size_t)NextRandom(rng);
+    }
+    const uint64_t threshold = (0 - range) % range;
+    uint64_t r;
+    do
+    {
+        r = NextRandom(rng);
+    } while (r < threshold);
+    return min + (size_t)(r % range);
+}
+
+/**
+ * Index of the lowest set bit. Do not use on 0.
+ */
+size_t CountTrailingZeros(
+    const unsigned x)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return index;
+#else
+    return (size_t)__builtin_ctz(x);
+#endif
+}
+
+/**
+ * Index of the lowest set bit. Do not use on 0.
+ */
+size_t CountTrailingZeros64(
+    const uint64_t x)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return index;
+#else
+    return (size_t)__builtin_ctzll(x);
+#endif
+}
+
 // Constants
 enum
 {
@@ -33,189 +202,4528 @@ enum
     MAX_RETRIES = 3,
 };
 
+/**
+ * One up-front allocation that every stack on a Board carves its storage out of.
+ * Nothing is ever returned to the arena individually; the whole thing is rewound between games.
+ */
+typedef struct
+{
+    _Field_size_(capacity) card_t *base;
+    size_t capacity;
+    _Field_range_(0, capacity) size_t used;
+    /** Whether base came from malloc, as opposed to a buffer the caller lent us. */
+    int owned;
+
+} CardArena;
+
+/**
+ * Carves the arena out of (buffer) if it is big enough, otherwise allocates.
+ * @param buffer Caller-supplied scratch space. Can be NULL.
+ */
+void ConstructArena(
+    _Out_ CardArena *arena,
+    const size_t capacity,
+    _Inout_updates_opt_(bufferSize) card_t *buffer,
+    const size_t bufferSize)
+{
+    arena->owned = !buffer || bufferSize < capacity;
+    arena->base = arena->owned ? (card_t *)malloc(capacity ? capacity : 1) : buffer;
+    arena->capacity = arena->base ? capacity : 0;
+    arena->used = 0;
+}
+
+void DestructArena(
+    _Inout_ CardArena *arena)
+{
+    if (arena->base && arena->owned)
+    {
+        free(arena->base);
+    }
+
+    arena->base = NULL;
+    arena->capacity = 0;
+    arena->used = 0;
+    arena->owned = 0;
+}
+
+/**
+ * Hands out (count)-many cards of storage. Returns NULL if the arena was sized too small,
+ * which would be a bug in whoever sized it rather than something to recover from.
+ */
+_Ret_maybenull_ card_t *ArenaAlloc(
+    _Inout_ CardArena *arena,
+    const size_t count)
+{
+    if (arena->capacity - arena->used < count)
+    {
+        return NULL;
+    }
+    card_t *block = arena->base + arena->used;
+    arena->used += count;
+    return block;
+}
+
+/**
+ * Every stack on the board, by index. Field stacks are numbered consecutively from STACK_FIELD.
+ */
+enum
+{
+    STACK_DECK = 0,
+    STACK_HAND,
+    STACK_FIELD,
+    STACK_ORDERED = STACK_FIELD + NUM_FIELD_STACKS, // Where complete pile goes - Would have a set of four stacks in real solitare, but we're only sorting one list.
+    NUM_STACKS,
+};
+
+enum
+{
+    NUM_RANKS = 1 << CHAR_BIT, // Every value a card_t can take
+    TRANSPOSITION_SIZE = 1 << 10, // Board states remembered per game. Must be a power of two.
+};
+
+/**
+ * Each stack's contents are hashed as a polynomial, sum of (rank + 1) * HASH_BASE^i from the bottom up.
+ * Unlike a table of per-position Zobrist keys, that survives cards being slid under the deck: the whole hash just shifts up by one power.
+ * The base is odd, so it can be inverted and a card taken back off the top.
+ */
+#define HASH_BASE 0x100000001B3ull
+#define HASH_BASE_INVERSE 0xCE965057AFF6957Bull
+
+/**
+ * Position of a card in sort order, 0 to NUM_RANKS - 1 whether or not char is signed.
+ */
+size_t CardRank(
+    const card_t card)
+{
+    return (size_t)((int)card - CHAR_MIN);
+}
+
+/**
+ * Enough to take one move or draw back exactly.
+ * Stacks never share storage and popping leaves cards where they were, so nothing but counts needs saving.
+ */
+typedef struct
+{
+    /** Cards moved, or cards drawn for a draw. */
+    size_t count;
+    /** Straight from the board beforehand. For a draw, the hand's are kept in src's pair. */
+    size_t srcVisible;
+    size_t srcMoveable;
+    size_t destVisible;
+    size_t destMoveable;
+    /** How many draws in a row led up to this move. */
+    size_t stalledDraws;
+    /** STACK_DECK for a draw. */
+    unsigned char src;
+    unsigned char dest;
+    /** Where a card played from the hand used to be, or the hand's size before a draw. */
+    unsigned char handIndex;
+    /** Which of its state's options this was, in the order the search tries them. */
+    unsigned char choice;
+
+} UndoRecord;
+
+/**
+ * Every move and draw since the deal, oldest first, for taking them back again.
+ */
+typedef struct
+{
+    UndoRecord *records;
+    size_t count;
+    size_t capacity;
+
+} UndoLog;
+
+/**
+ * The whole game laid out as a structure of arrays over a single buffer.
+ * Stack i owns cards[i][0 .. capacity[i]), with the bottom card first.
+ * The foundation may instead live in the caller's own buffer, so a won game is already sorted in place.
+ *
+ * The per-stack metadata is packed together ahead of anything cold, so a move scan over the field
+ * only touches a couple of cache lines, and all the tops can be compared without chasing a pointer per stack.
+ */
 typedef struct
 {
-    _Field_size_(numCards) card_t *cards;
-    size_t numCards;
+    size_t numCards[NUM_STACKS];
     /** Should not transfer more than this outside of setup. */
-    _Field_range_(0, numCards) size_t visible;
+    size_t visible[NUM_STACKS];
+    /** How many cards off the top form an ordered run that can be moved together. Kept up to date on every push, pop and reveal. */
+    size_t moveable[NUM_STACKS];
+    /** Copy of the card on top of each non-empty stack. */
+    card_t top[NUM_STACKS];
+    /**
+     * For stable games, how many cards later in the input share each tag's key. NULL otherwise.
+     * Every stacking and founding check looks here first, so it sits with the hot metadata.
+     */
+    const uint32_t *later;
+
+    card_t *cards[NUM_STACKS];
+    size_t capacity[NUM_STACKS];
+    /** The deck is a ring so cards can be slid underneath it. Its bottom card is at this index of its storage, the top is numCards later. */
+    size_t deckHead;
+    CardArena arena; // Backing storage for every stack
+    Rng rng;         // Reseeded for every game
 
-} CardStack;
+    /** How many of each card have yet to reach the foundation. Lets the dealer say which card goes there next, like knowing it's ace first. */
+    size_t remaining[NUM_RANKS];
+    /** The rank of the next card the foundation will take. */
+    size_t nextRank;
+    /** nextRank as of the last bulk sweep. The deck can't hold any more of that rank, so there is no point sweeping again until it moves on. */
+    size_t sweptRank;
+    /** SOLITAIRE_SORT_* flags for the call this board is playing for. */
+    unsigned flags;
+    /** Moves a game may take back while searching for a win. 0 plays the single greedy line. */
+    size_t searchBudget;
+    /** How moves are scored for the call this board is playing for. */
+    const SolitaireSortWeights *weights;
+
+    /** Running hash of every deck and field stack, kept current on every push and pop. The hand is small enough to hash when asked. */
+    uint64_t hash[NUM_STACKS];
+    /** HASH_BASE to the power of each stack's card count. */
+    uint64_t hashPower[NUM_STACKS];
+    /** Direct-mapped table of the board states seen this game, 0 for an empty slot. A repeat means the game is going round in circles. */
+    uint64_t seen[TRANSPOSITION_SIZE];
+
+    /** Kept only while logging is set, which the search and replays need. Emptied by every deal. */
+    UndoLog log;
+    int logging;
+
+    /** Moves and draws made on this board, over every game since it was built. */
+    size_t movesPlayed;
+    /** Heap allocations made for this board: its arena, unless lent one, and every time the log grew. */
+    size_t allocations;
+    /** Only kept with SOLITAIRE_SORT_COUNTERS. The board belongs to one thread, so these are plain adds. */
+    SolitaireSortCounters counters;
+    /** Where this board's events go, or NULL to record nothing. Only this board's thread writes to it. */
+    SolitaireSortTrace *trace;
+    /** The trace's capacity - 1. */
+    size_t traceMask;
+    /**
+     * Laid out like the arena, so the card at arena.base[i] is tagged with tags[i]: its index in the input.
+     * NULL unless the game is sorting records, which is the only time anybody needs to know which card is which.
+     */
+    uint32_t *tags;
+} Board;
 
 /**
- * Unassertable assumption: src array must be EXACTLY (count)-many elements.
- * To construct empty, provide empty array and 0 in count.
+ * The first card of a stack's storage.
  */
-void ConstructStack(
-    _Out_ CardStack *stack,
-    _In_reads_(count) const card_t src[],
-    const size_t count,
-    const size_t visible)
+card_t *StackCards(
+    _In_ const Board *board,
+    const size_t stack)
+{
+    return board->cards[stack];
+}
+
+/**
+ * The tags of a stack's cards, lined up with StackCards. Only for tagged boards.
+ */
+uint32_t *StackTags(
+    _In_ const Board *board,
+    const size_t stack)
+{
+    return board->tags + (board->cards[stack] - board->arena.base);
+}
+
+/**
+ * The tag of the card at (card), somewhere in the arena of a tagged board.
+ */
+uint32_t CardTag(
+    _In_ const Board *board,
+    _In_ const card_t *card)
 {
-    stack->cards = (card_t *)malloc(count);
-    stack->numCards = count;
-    stack->visible = visible;
+    return board->tags[card - board->arena.base];
 }
 
-// Might be misunderstanding the SAL notation.
-// In case I get warnings or errors later on: stack will not be null, but its insides will be emptied and nullified.
-void DestructStack(
-    _Inout_ CardStack *stack)
+/**
+ * Takes the tags along for a copy of (count)-many cards from (src) to (dest), anywhere in the arena. Does nothing on an untagged board.
+ */
+void CopyTags(
+    _In_ const Board *board,
+    _In_ const card_t *dest,
+    _In_ const card_t *src,
+    const size_t count)
 {
-    if (stack->cards)
+    if (board->tags)
     {
-        free(stack->cards);
+        memmove(board->tags + (dest - board->arena.base), board->tags + (src - board->arena.base), count * sizeof(uint32_t));
     }
+}
+
+/**
+ * memmove for cards, tags and all.
+ */
+void CopyCards(
+    _In_ const Board *board,
+    _Out_writes_(count) card_t *dest,
+    _In_reads_(count) const card_t *src,
+    const size_t count)
+{
+    memmove(dest, src, count);
+    CopyTags(board, dest, src, count);
+}
+
+/**
+ * Treat output as boolean
+ */
+int IsFieldStack(
+    const size_t stack)
+{
+    return stack >= STACK_FIELD && stack < STACK_FIELD + NUM_FIELD_STACKS;
+}
+
+/**
+ * What the card at (card) adds to a stack's hash.
+ * In a stable game, equal cards in a different order make a different position, so the tag goes in too.
+ */
+uint64_t CardHash(
+    _In_ const Board *board,
+    _In_ const card_t *card)
+{
+    const uint64_t hash = (uint64_t)CardRank(*card) + 1;
+    return board->later ? hash + ((uint64_t)CardTag(board, card) << 9) : hash;
+}
+
+void HashPushTop(
+    _Inout_ Board *board,
+    const size_t stack,
+    _In_ const card_t *card)
+{
+    board->hash[stack] += CardHash(board, card) * board->hashPower[stack];
+    board->hashPower[stack] *= HASH_BASE;
+}
+
+void HashPopTop(
+    _Inout_ Board *board,
+    const size_t stack,
+    _In_ const card_t *card)
+{
+    board->hashPower[stack] *= HASH_BASE_INVERSE;
+    board->hash[stack] -= CardHash(board, card) * board->hashPower[stack];
+}
+
+void HashPushUnder(
+    _Inout_ Board *board,
+    const size_t stack,
+    _In_ const card_t *card)
+{
+    board->hash[stack] = board->hash[stack] * HASH_BASE + CardHash(board, card);
+    board->hashPower[stack] *= HASH_BASE;
+}
+
+/**
+ * Points the board's events at (trace). One that is NULL, or has no power-of-two room, records nothing.
+ */
+void AttachTrace(
+    _Inout_ Board *board,
+    _In_opt_ SolitaireSortTrace *trace)
+{
+    const int usable = trace && trace->events && trace->capacity != 0 && (trace->capacity & (trace->capacity - 1)) == 0;
+    board->trace = usable ? trace : NULL;
+    board->traceMask = usable ? trace->capacity - 1 : 0;
+}
 
-    // Just to be safe in case some schmuck like myself tries to reuse a destructed stack.
-    stack->cards = NULL;
-    stack->numCards = 0;
-    stack->visible = 0;
+/**
+ * Writes the next event into the board's ring, over the oldest if it is full. Only call if board->trace is set,
+ * which callers test first so they don't work out (card) for nothing.
+ */
+void TraceEvent(
+    _Inout_ Board *board,
+    const SolitaireSortEventKind kind,
+    const size_t src,
+    const size_t dest,
+    const size_t count,
+    const card_t card)
+{
+    SolitaireSortTrace *trace = board->trace;
+    SolitaireSortEvent *event = &trace->events[(size_t)(trace->written++ & board->traceMask)];
+    event->count = count > UINT32_MAX ? UINT32_MAX : (uint32_t)count;
+    event->kind = (uint8_t)kind;
+    event->src = (uint8_t)src;
+    event->dest = (uint8_t)dest;
+    event->card = card;
 }
 
 /**
  * Unassertable assumption: src array must be AT LEAST (start + count)-many elements.
+ * The stack's capacity was reserved up front, so this is just a copy of the new cards and a length update.
+ * On a tagged board src has to be somewhere in the arena, so the tags can come too.
  */
 void PushToStack(
-    _Inout_ CardStack *stack,
+    _Inout_ Board *board,
+    const size_t stack,
     _In_reads_(start + count) const card_t src[],
     const size_t start,
     const size_t count)
 {
-    card_t *temp = stack->cards;
-
-    const size_t newNumCards = stack->numCards + count;
-    stack->cards = (card_t *)malloc(newNumCards);
+    // Overflowing the reservation means the board was sized wrong. Drop the push rather than scribble over a neighbour.
+    if (count == 0 || board->capacity[stack] - board->numCards[stack] < count)
+    {
+        return;
+    }
 
+    memcpy(StackCards(board, stack) + board->numCards[stack], src + start, count);
+    CopyTags(board, StackCards(board, stack) + board->numCards[stack], src + start, count);
+    board->numCards[stack] += count;
+    board->top[stack] = src[start + count - 1];
+    if (IsFieldStack(stack))
     {
-        size_t i = 0;
-        // Copy over pre-existing elements
-        for (; i < stack->numCards; ++i)
+        const card_t *pushed = StackCards(board, stack) + board->numCards[stack] - count;
+        for (size_t i = 0; i < count; ++i)
         {
-            stack->cards[i] = temp[i];
+            HashPushTop(board, stack, &pushed[i]);
         }
-        // Push new elements
-        for (size_t j = start; (i < newNumCards) && (j < start + count); ++i, ++j)
+    }
+}
+
+void PopFromStack(
+    _Inout_ Board *board,
+    const size_t stack,
+    const size_t count)
+{
+    if (IsFieldStack(stack))
+    {
+        // Popped cards stay where they were, so they can still be taken back off the hash.
+        const card_t *cards = StackCards(board, stack);
+        for (size_t i = board->numCards[stack]; i > board->numCards[stack] - count; --i)
         {
-            stack->cards[i] = src[j];
+            HashPopTop(board, stack, &cards[i - 1]);
         }
     }
-
-    // The fact that temp might have been null will not matter until we try to free it.
-    // The for loop above would only have tried to access temp's elements if numCards != 0,
-    // which would mean it was initialized incorrectly anyway--and that's not this function's problem to deal with.
-    if (temp)
+    board->numCards[stack] -= count;
+    if (board->numCards[stack] != 0)
     {
-        free(temp);
+        board->top[stack] = StackCards(board, stack)[board->numCards[stack] - 1];
     }
-
-    stack->numCards = newNumCards;
 }
 
-void PopFromStack(
-    _Inout_ CardStack *stack,
-    const size_t count)
+/**
+ * The scores the player was first written with. Clearing a stack's face-up run to get at what is under it is worth more than
+ * anything but the foundation, and an empty stack is the last place a card from the hand should go.
+ */
+static const SolitaireSortWeights DEFAULT_WEIGHTS = {
+    1000, // foundFromField
+    900,  // foundFromHand
+    500,  // reveal
+    1,    // revealDepth
+    300,  // handToStack
+    200,  // merge
+    100,  // handToEmpty
+};
+
+/**
+ * Treat output as boolean. Whether the arena for a board of (size)-many cards, with its own foundation or not, fits in a size_t.
+ * Counting mode never chunks, so on a 32-bit build a big enough file would otherwise wrap the size round to a tiny arena.
+ */
+int BoardFits(
+    const size_t size)
 {
-    stack->numCards -= count;
+    return size <= (SIZE_MAX - NUM_CARDS_IN_HAND) / (NUM_FIELD_STACKS + 2);
 }
 
-void TransferCards(
-    const size_t start,
-    const size_t count,
-    _Inout_ CardStack *src,
-    _Inout_ CardStack *dest)
+/**
+ * Bytes of arena a board for (size)-many cards needs, or SIZE_MAX if no board that big can be built.
+ * Any card can end up in any stack, so every stack but the hand is given room for the whole game.
+ */
+size_t BoardArenaSize(
+    const size_t size,
+    const int ownFoundation)
 {
-    PushToStack(dest, src->cards, start, count);
-    PopFromStack(src, count);
+    if (!BoardFits(size))
+    {
+        return SIZE_MAX;
+    }
+    return size * (NUM_FIELD_STACKS + 1 + (ownFoundation ? 1 : 0)) + NUM_CARDS_IN_HAND;
 }
 
-typedef CardStack Deck;
+/**
+ * Reserves storage for a game of (size)-many cards.
+ * @param foundation Where the sorted cards should end up, at least (size) long. If NULL, the board reserves its own.
+ * @param scratch Lent storage for the arena, used instead of allocating if it is at least BoardArenaSize. Can be NULL.
+ */
+_Success_(return == 0) int ConstructBoard(
+    _Out_ Board *board,
+    const size_t size,
+    _Out_writes_opt_(size) card_t *foundation,
+    _Inout_updates_opt_(scratchSize) card_t *scratch,
+    const size_t scratchSize)
+{
+    // Too big a board can't even be asked for, so it is never handed the scratch or allocated.
+    const int fits = BoardFits(size);
+    ConstructArena(&board->arena, fits ? BoardArenaSize(size, foundation == NULL) : 0, fits ? scratch : NULL, scratchSize);
+    board->tags = NULL;
+    board->later = NULL;
+    board->log.records = NULL;
+    board->log.count = 0;
+    board->log.capacity = 0;
+    board->logging = 0;
+    board->weights = &DEFAULT_WEIGHTS;
+    board->movesPlayed = 0;
+    board->allocations = board->arena.owned;
+    memset(&board->counters, 0, sizeof(board->counters));
+    AttachTrace(board, NULL);
+    COUNT_EVENT(board, bytesAllocated, board->arena.owned ? board->arena.capacity : 0);
+    if (!fits || !board->arena.base)
+    {
+        DestructArena(&board->arena);
+        return 1;
+    }
+
+    for (size_t i = 0; i < NUM_STACKS; ++i)
+    {
+        board->capacity[i] = (i == STACK_HAND) ? (size_t)NUM_CARDS_IN_HAND : size;
+        board->cards[i] = (i == STACK_ORDERED && foundation) ? foundation : ArenaAlloc(&board->arena, board->capacity[i]);
+        if (!board->cards[i])
+        {
+            DestructArena(&board->arena);
+            return 1;
+        }
+    }
+    return 0;
+}
 
-typedef struct
+void DestructBoard(
+    _Inout_ Board *board)
 {
-    Deck deck;
-    CardStack hand;
-    CardStack field[NUM_FIELD_STACKS]; // Unordered cards in the process of being ordered
-    CardStack ordered[1];              // Where complete pile goes - Would have a set of four stacks in real solitare, but we're only sorting one list.
-} Board;
+    DestructArena(&board->arena);
+    free(board->log.records);
+    board->log.records = NULL;
+    free(board->tags);
+    board->tags = NULL;
+}
 
-void Shuffle(
-    _Inout_ Deck *deck)
+/**
+ * Gives every card on the board room for a tag. Only for boards with their own foundation:
+ * one in the caller's buffer is outside the arena, where tags can't follow.
+ */
+_Success_(return == 0) int AttachTags(
+    _Inout_ Board *board)
 {
-    // todo
+    if (board->arena.capacity > SIZE_MAX / sizeof(uint32_t))
+    {
+        return 1;
+    }
+    board->tags = (uint32_t *)malloc((board->arena.capacity ? board->arena.capacity : 1) * sizeof(uint32_t));
+    if (!board->tags)
+    {
+        return 1;
+    }
+    ++board->allocations;
+    COUNT_EVENT(board, bytesAllocated, board->arena.capacity * sizeof(uint32_t));
+    return 0;
 }
 
 /**
- * Splits deck onto field
+ * Empties every stack, assuming the deck already holds all (size) cards. The dealer's tally is left at zero for ShuffleAndDeal to count.
  */
-void Deal(
-    _Inout_ Deck *deck,
-    _Out_ Board *board)
+void ClearBoard(
+    _Inout_ Board *board,
+    const size_t size)
 {
-    for (size_t stackToFill = NUM_FIELD_STACKS; stackToFill > 0; --stackToFill)
+    for (size_t i = 0; i < NUM_STACKS; ++i)
     {
-        for (size_t i = 0; i < stackToFill; ++i)
-        {
-            // todo
-        }
+        board->numCards[i] = 0;
+        board->visible[i] = 0;
+        board->moveable[i] = 0;
+        board->top[i] = 0;
+        board->hash[i] = 0;
+        board->hashPower[i] = 1;
     }
+    memset(board->seen, 0, sizeof(board->seen));
+    board->log.count = 0;
+    board->numCards[STACK_DECK] = size;
+    board->deckHead = 0;
+    for (size_t i = 0; i < NUM_RANKS; ++i)
+    {
+        board->remaining[i] = 0;
+    }
+    board->sweptRank = NUM_RANKS;
 }
 
 /**
- * Treat output as boolean
+ * Empties every stack and puts (data) in the deck.
+ * Reuses the storage from the previous game rather than allocating again. On a tagged board, each card is tagged with its index in (data).
  */
-char CheckOrdered(
+void ResetBoard(
+    _Inout_ Board *board,
     _In_reads_(size) const card_t data[],
     const size_t size)
 {
-    for (size_t i = 1; i < size; ++i)
+    memcpy(StackCards(board, STACK_DECK), data, size);
+    if (board->tags)
     {
-        if (data[i - 1] > data[i])
+        uint32_t *tags = StackTags(board, STACK_DECK);
+        for (size_t i = 0; i < size; ++i)
         {
-            return 0;
+            tags[i] = (uint32_t)i;
         }
     }
-    return 1;
+    ClearBoard(board, size);
 }
 
-_Success_(return == 0) int TrySort(
-    _Out_ CardStack *result,
-    _In_reads_(size) const card_t data[],
+/**
+ * Sweeps every card left over from the last game back into the deck, in no particular order, ready for another shuffle.
+ * This is how a retry starts when the foundation is the caller's buffer and the original input is gone.
+ */
+void CollectCards(
+    _Inout_ Board *board,
     const size_t size)
 {
-    Deck deck;
-    ConstructStack(&deck, data, size, 0);
+    card_t *deck = StackCards(board, STACK_DECK);
+    const size_t numInDeck = board->numCards[STACK_DECK];
+    const size_t head = board->deckHead;
+    const size_t capacity = board->capacity[STACK_DECK];
 
-    Board board;
-    Deal(&deck, &board);
-
-    // todo
-    ConstructStack(result, data, size, 0);
+    // Straighten the ring out so the deck starts at 0. Order doesn't matter, so the wrapped part can just slide down.
+    if (head + numInDeck > capacity)
+    {
+        const size_t wrapped = head + numInDeck - capacity;
+        CopyCards(board, deck + wrapped, deck + head, capacity - head);
+    }
+    else
+    {
+        CopyCards(board, deck, deck + head, numInDeck);
+    }
 
-    // todo
+    size_t used = numInDeck;
+    for (size_t i = 0; i < NUM_STACKS; ++i)
+    {
+        if (i != STACK_DECK)
+        {
+            CopyCards(board, deck + used, StackCards(board, i), board->numCards[i]);
+            used += board->numCards[i];
+        }
+    }
 
-    CheckOrdered(result->cards, result->numCards);
+    ClearBoard(board, size);
+}
 
-    return 0;
+/**
+ * Starts the deck's hash over from its cards, for after it has been rearranged wholesale.
+ */
+void RehashDeck(
+    _Inout_ Board *board)
+{
+    const card_t *deck = StackCards(board, STACK_DECK);
+    const size_t capacity = board->capacity[STACK_DECK];
+    board->hash[STACK_DECK] = 0;
+    board->hashPower[STACK_DECK] = 1;
+    for (size_t k = 0, slot = board->deckHead; k < board->numCards[STACK_DECK]; ++k, slot = (slot + 1 == capacity) ? 0 : slot + 1)
+    {
+        HashPushTop(board, STACK_DECK, &deck[slot]);
+    }
 }
 
-_Success_(return == 0) int SolitaireSort(
-    _Inout_updates_all_(size) card_t *data[],
-    const size_t size)
+/**
+ * Removes the top card of the deck. Do not use if the deck is empty.
+ * @return Where the card was. It stays there until the deck grows back over it, so it can be copied from.
+ */
+const card_t *PullFromDeck(
+    _Inout_ Board *board)
 {
-    for (size_t i = 0; i < MAX_RETRIES; ++i) // Can retry a maximum of three times before returning with error.
+    size_t slot = board->deckHead + --board->numCards[STACK_DECK];
+    if (slot >= board->capacity[STACK_DECK])
     {
-        CardStack result; // Will get assigned by TrySort
-        if (TrySort(&result, *data, size) == 0)
-        {
-            for (size_t i = 0; i < size; ++i)
-            {
-                (*data)[i] = result.cards[i];
-            }
-            DestructStack(&result);
-            return 0;
-        }
-        DestructStack(&result);
+        slot -= board->capacity[STACK_DECK];
     }
-    return 1;
+    const card_t *card = StackCards(board, STACK_DECK) + slot;
+    HashPopTop(board, STACK_DECK, card);
+    return card;
+}
+
+/**
+ * Slides a copy of (card), from elsewhere on the board, underneath the deck.
+ */
+void PushUnderDeck(
+    _Inout_ Board *board,
+    _In_ const card_t *card)
+{
+    board->deckHead = (board->deckHead == 0 ? board->capacity[STACK_DECK] : board->deckHead) - 1;
+    CopyCards(board, StackCards(board, STACK_DECK) + board->deckHead, card, 1);
+    ++board->numCards[STACK_DECK];
+    HashPushUnder(board, STACK_DECK, StackCards(board, STACK_DECK) + board->deckHead);
+}
+
+/**
+ * Puts a copy of (card), from elsewhere on the board, back on top of the deck. Only ever used to take back a draw.
+ */
+void PushOntoDeck(
+    _Inout_ Board *board,
+    _In_ const card_t *card)
+{
+    size_t slot = board->deckHead + board->numCards[STACK_DECK]++;
+    if (slot >= board->capacity[STACK_DECK])
+    {
+        slot -= board->capacity[STACK_DECK];
+    }
+    CopyCards(board, StackCards(board, STACK_DECK) + slot, card, 1);
+    HashPushTop(board, STACK_DECK, StackCards(board, STACK_DECK) + slot);
+}
+
+/**
+ * Removes the bottom card of the deck. Only ever used to take back a draw.
+ * @return Where the card was, like PullFromDeck.
+ */
+const card_t *PullFromUnderDeck(
+    _Inout_ Board *board)
+{
+    const card_t *card = StackCards(board, STACK_DECK) + board->deckHead;
+    board->deckHead = (board->deckHead + 1 == board->capacity[STACK_DECK]) ? 0 : board->deckHead + 1;
+    --board->numCards[STACK_DECK];
+    board->hash[STACK_DECK] = (board->hash[STACK_DECK] - CardHash(board, card)) * HASH_BASE_INVERSE;
+    board->hashPower[STACK_DECK] *= HASH_BASE_INVERSE;
+    return card;
+}
+
+/**
+ * Removes the card at the provided index of the hand, closing the gap. The hand allows random access.
+ * The card is overwritten, so copy it somewhere first.
+ */
+void PullFromHand(
+    _Inout_ Board *board,
+    const size_t index)
+{
+    card_t *hand = StackCards(board, STACK_HAND);
+    CopyCards(board, hand + index, hand + index + 1, board->numCards[STACK_HAND] - index - 1);
+    PopFromStack(board, STACK_HAND, 1);
+}
+
+/**
+ * Passes the full contents of the hand to the bottom of the deck, then pulls
+ * NUM_CARDS_IN_HAND cards from the top of the deck to insert back into the hand.
+ * If the deck has fewer than NUM_CARDS_IN_HAND cards, the entire remaining deck will be emptied into the hand.
+ */
+void DrawHand(
+    _Inout_ Board *board)
+{
+    card_t *hand = StackCards(board, STACK_HAND);
+    for (size_t i = board->numCards[STACK_HAND]; i > 0; --i)
+    {
+        PushUnderDeck(board, &hand[i - 1]);
+    }
+
+    const size_t count = board->numCards[STACK_DECK] < NUM_CARDS_IN_HAND ? board->numCards[STACK_DECK] : (size_t)NUM_CARDS_IN_HAND;
+    for (size_t i = count; i > 0; --i)
+    {
+        CopyCards(board, &hand[i - 1], PullFromDeck(board), 1);
+    }
+    board->numCards[STACK_HAND] = count;
+    board->visible[STACK_HAND] = count;
+    if (count != 0)
+    {
+        board->top[STACK_HAND] = hand[count - 1];
+    }
+}
+
+/**
+ * Treat output as boolean. Whether (card), from anywhere on the board, can go onto non-empty field stack (dest): its top can't be smaller.
+ * A stable game breaks ties by tag, so the earlier of two equal cards is always the one on top, ready to be founded first.
+ */
+int StacksOn(
+    _In_ const Board *board,
+    _In_ const card_t *card,
+    const size_t dest)
+{
+    const card_t top = board->top[dest];
+    if (!board->later || top != *card)
+    {
+        return !(top < *card);
+    }
+    return CardTag(board, StackCards(board, dest) + board->numCards[dest] - 1) > CardTag(board, card);
+}
+
+/**
+ * Puts (count)-many cards on top of a stack, keeping its bookkeeping current.
+ * Field stacks extend their moveable run if the new cards continue it; the foundation advances the dealer's tally.
+ */
+void PlaceCards(
+    _Inout_ Board *board,
+    const size_t dest,
+    _In_reads_(count) const card_t cards[],
+    const size_t count)
+{
+    if (IsFieldStack(dest))
+    {
+        const int continuesRun = board->moveable[dest] != 0 && StacksOn(board, cards, dest);
+        board->moveable[dest] = continuesRun ? board->moveable[dest] + count : count;
+        board->visible[dest] += count;
+    }
+    else if (dest == STACK_ORDERED)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            --board->remaining[CardRank(cards[i])];
+        }
+        while (board->nextRank < NUM_RANKS && board->remaining[board->nextRank] == 0)
+        {
+            ++board->nextRank;
+        }
+    }
+    PushToStack(board, dest, cards, 0, count);
+}
+
+/**
+ * Takes (count)-many visible cards off the top of a field stack, flipping the next card if that cleared every face-up one.
+ */
+void TakeFromField(
+    _Inout_ Board *board,
+    const size_t src,
+    const size_t count)
+{
+    PopFromStack(board, src, count);
+    board->visible[src] -= count;
+    board->moveable[src] -= count;
+    if (board->visible[src] == 0 && board->numCards[src] != 0)
+    {
+        board->visible[src] = 1;
+        board->moveable[src] = 1;
+        COUNT_EVENT(board, reveals, 1);
+    }
+}
+
+/**
+ * Moves the top (count)-many cards of a field stack onto dest.
+ * Stacks never share storage, and popping leaves the cards where they were, so the run can be copied straight across.
+ */
+void TransferCards(
+    _Inout_ Board *board,
+    const size_t src,
+    const size_t dest,
+    const size_t count)
+{
+    PlaceCards(board, dest, StackCards(board, src) + board->numCards[src] - count, count);
+    TakeFromField(board, src, count);
+}
+
+/**
+ * Randomizes the order of the cards in the deck (Fisher-Yates, exactly like Deck.shuffle() in the TS port) and splits it onto the field.
+ * Each stack in the field gets one more card than the previous, and the first gets 1. Only the top card of each is face up.
+ * Stops early if the deck runs out.
+ *
+ * Fisher-Yates settles the deck from the top down, which is the order the deal takes cards in, so every card is dealt, tallied for
+ * the dealer or hashed into the deck the moment it is settled. That is one pass over the deck per game rather than four, and the cards
+ * dealt are never hashed into the deck just to be hashed out again. The deck's hash is built top down, every card going under the last.
+ */
+void ShuffleAndDeal(
+    _Inout_ Board *board)
+{
+    card_t *cards = StackCards(board, STACK_DECK);
+    uint32_t *tags = board->tags ? StackTags(board, STACK_DECK) : NULL;
+    const size_t size = board->numCards[STACK_DECK];
+    const size_t fieldSize = NUM_FIELD_STACKS * (NUM_FIELD_STACKS + 1) / 2;
+    const size_t numDealt = size < fieldSize ? size : fieldSize;
+
+    size_t stack = STACK_FIELD;
+    for (size_t i = size; i > 0; --i)
+    {
+        if (i > 1)
+        {
+            const size_t j = RandBetween(&board->rng, 0, i - 1);
+            const card_t temp = cards[i - 1];
+            cards[i - 1] = cards[j];
+            cards[j] = temp;
+            if (tags)
+            {
+                const uint32_t tag = tags[i - 1];
+                tags[i - 1] = tags[j];
+                tags[j] = tag;
+            }
+        }
+
+        ++board->remaining[CardRank(cards[i - 1])];
+        if (i > size - numDealt)
+        {
+            PushToStack(board, stack, cards, i - 1, 1);
+            // Stack k gets k + 1 cards.
+            stack += board->numCards[stack] == stack - STACK_FIELD + 1;
+        }
+        else
+        {
+            HashPushUnder(board, STACK_DECK, &cards[i - 1]);
+        }
+    }
+    board->numCards[STACK_DECK] = size - numDealt;
+
+    board->nextRank = 0;
+    while (board->nextRank < NUM_RANKS && board->remaining[board->nextRank] == 0)
+    {
+        ++board->nextRank;
+    }
+    for (size_t i = 0; i < NUM_FIELD_STACKS; ++i)
+    {
+        board->visible[STACK_FIELD + i] = board->numCards[STACK_FIELD + i] != 0;
+        board->moveable[STACK_FIELD + i] = board->visible[STACK_FIELD + i];
+    }
+    DrawHand(board);
+}
+
+enum
+{
+    GAME_LOSS = 0, // No moves possible, didn't win.
+    GAME_PLAYING,  // Moves possible.
+    GAME_WIN,      // No moves possible, won.
+};
+
+/**
+ * Treat output as boolean. Whether (card), found at (slot), is the next one the foundation takes.
+ * A stable game only takes the earliest card left of each key, which is the one with as many equal cards after it as are left besides.
+ * Only a stable game looks at the slot.
+ */
+int CanFound(
+    _In_ const Board *board,
+    const card_t card,
+    _In_ const card_t *slot)
+{
+    return CardRank(card) == board->nextRank && (!board->later || board->later[CardTag(board, slot)] + 1 == board->remaining[board->nextRank]);
+}
+
+/**
+ * The best field stack to put a run with (bottom) at its base on: the non-empty stack with the smallest top that
+ * still takes it, falling back to an empty stack if allowed. Returns NUM_STACKS if nothing fits.
+ * Only reads the packed tops and lengths, never the cards themselves, but for ties in a stable game.
+ */
+size_t BestDestination(
+    _In_ const Board *board,
+    _In_ const card_t *bottom,
+    const size_t exclude,
+    const int allowEmpty)
+{
+    size_t best = NUM_STACKS;
+    size_t empty = NUM_STACKS;
+    for (size_t dest = STACK_FIELD; dest < STACK_FIELD + NUM_FIELD_STACKS; ++dest)
+    {
+        if (dest == exclude)
+        {
+            continue;
+        }
+        if (board->numCards[dest] == 0)
+        {
+            if (empty == NUM_STACKS)
+            {
+                empty = dest;
+            }
+        }
+        else if (StacksOn(board, bottom, dest) && (best == NUM_STACKS || board->top[dest] < board->top[best]))
+        {
+            best = dest;
+        }
+    }
+    return (best != NUM_STACKS || !allowEmpty) ? best : empty;
+}
+
+/**
+ * A performable move in the game. Plain data so a whole step's worth of them fits in a buffer on the stack.
+ */
+typedef struct
+{
+    /** Number of cards moved for field sources, index of the card for the hand. */
+    size_t count;
+    /** Value of playing this move. */
+    int score;
+    unsigned char src;
+    unsigned char dest;
+
+} Move;
+
+enum
+{
+    // Every field stack and every card in hand offers at most its single best move.
+    MAX_MOVES = NUM_FIELD_STACKS + NUM_CARDS_IN_HAND,
+};
+
+/**
+ * The candidate moves for one step, best one noted as they are written.
+ */
+typedef struct
+{
+    Move moves[MAX_MOVES];
+    size_t numMoves;
+    /** Index into moves, only meaningful if numMoves != 0. */
+    size_t best;
+
+} MoveList;
+
+void OfferMove(
+    _Inout_ MoveList *list,
+    const size_t src,
+    const size_t dest,
+    const size_t count,
+    const int score)
+{
+    Move *move = &list->moves[list->numMoves];
+    move->count = count;
+    move->score = score;
+    move->src = (unsigned char)src;
+    move->dest = (unsigned char)dest;
+    if (list->numMoves == 0 || score > list->moves[list->best].score)
+    {
+        list->best = list->numMoves;
+    }
+    ++list->numMoves;
+}
+
+/**
+ * Clearing a run off a stack that has (depth) face-down cards under it. Held to what a score can hold, since the weights can be anything.
+ */
+int RevealScore(
+    _In_ const SolitaireSortWeights *weights,
+    const size_t depth)
+{
+    const int64_t score = (int64_t)weights->reveal + (int64_t)weights->revealDepth * (int64_t)(depth < (size_t)INT_MAX ? depth : (size_t)INT_MAX);
+    return score > INT_MAX ? INT_MAX : score < INT_MIN ? INT_MIN : (int)score;
+}
+
+/**
+ * Writes out the possible moves in the gamestate, drawing aside. If none are written, the only thing left to do is draw.
+ * Every candidate is worked out from the cached tops and moveable runs, so this is O(NUM_FIELD_STACKS^2) with no rescanning of stacks.
+ */
+void GenerateMoves(
+    _In_ const Board *board,
+    _Out_ MoveList *list)
+{
+    list->numMoves = 0;
+    list->best = 0;
+
+    for (size_t src = STACK_FIELD; src < STACK_FIELD + NUM_FIELD_STACKS; ++src)
+    {
+        const size_t numCards = board->numCards[src];
+        const size_t run = board->moveable[src];
+        if (numCards == 0)
+        {
+            continue;
+        }
+
+        if (CanFound(board, board->top[src], StackCards(board, src) + numCards - 1))
+        {
+            OfferMove(list, src, STACK_ORDERED, 1, board->weights->foundFromField);
+        }
+        // Only whole runs are worth moving: the card under a partial run is never smaller than the run's top.
+        else if (run == board->visible[src] && run != numCards)
+        {
+            const size_t dest = BestDestination(board, StackCards(board, src) + numCards - run, src, 1);
+            if (dest != NUM_STACKS)
+            {
+                OfferMove(list, src, dest, run, RevealScore(board->weights, numCards - run)); // Reveals a card, the deeper the pile the better
+            }
+        }
+        else if (run == numCards)
+        {
+            const size_t dest = BestDestination(board, StackCards(board, src), src, 0);
+            if (dest != NUM_STACKS)
+            {
+                OfferMove(list, src, dest, run, board->weights->merge); // Merging a bare run onto another stack frees up an empty stack
+            }
+        }
+    }
+
+    const card_t *hand = StackCards(board, STACK_HAND);
+    for (size_t i = 0; i < board->numCards[STACK_HAND]; ++i)
+    {
+        if (CanFound(board, hand[i], &hand[i]))
+        {
+            OfferMove(list, STACK_HAND, STACK_ORDERED, i, board->weights->foundFromHand);
+            continue;
+        }
+        const size_t dest = BestDestination(board, &hand[i], NUM_STACKS, 1);
+        if (dest != NUM_STACKS)
+        {
+            OfferMove(list, STACK_HAND, dest, i, board->numCards[dest] != 0 ? board->weights->handToStack : board->weights->handToEmpty);
+        }
+    }
+}
+
+void ExecuteMove(
+    _Inout_ Board *board,
+    _In_ const Move *move)
+{
+    if (move->src == STACK_HAND)
+    {
+        PlaceCards(board, move->dest, StackCards(board, STACK_HAND) + move->count, 1);
+        PullFromHand(board, move->count);
+    }
+    else
+    {
+        TransferCards(board, move->src, move->dest, move->count);
+    }
+}
+
+/**
+ * Counting-mode shortcut for cycling the whole deck through the hand, playing every card the foundation will take along the way.
+ * The tally says exactly how many of each rank are left, so one counting pass over the deck shows how far the foundation can get
+ * from the deck alone: every rank whose remaining cards are all in the deck, plus whatever the deck holds of the first rank that isn't.
+ * A second pass scatters those cards onto the foundation in rank order and closes the deck up behind them, keeping its order.
+ * @return How many cards were placed.
+ */
+size_t SweepDeckToFoundation(
+    _Inout_ Board *board)
+{
+    // Same as the start of a draw: the hand goes under the deck.
+    card_t *hand = StackCards(board, STACK_HAND);
+    for (size_t i = board->numCards[STACK_HAND]; i > 0; --i)
+    {
+        PushUnderDeck(board, &hand[i - 1]);
+    }
+    board->numCards[STACK_HAND] = 0;
+    board->visible[STACK_HAND] = 0;
+    board->sweptRank = board->nextRank;
+
+    card_t *deck = StackCards(board, STACK_DECK);
+    const size_t numInDeck = board->numCards[STACK_DECK];
+    const size_t capacity = board->capacity[STACK_DECK];
+
+    size_t inDeck[NUM_RANKS] = {0};
+    for (size_t k = 0, slot = board->deckHead; k < numInDeck; ++k, slot = (slot + 1 == capacity) ? 0 : slot + 1)
+    {
+        ++inDeck[CardRank(deck[slot])];
+    }
+
+    // Where each taken rank starts on the foundation.
+    size_t start[NUM_RANKS];
+    size_t placed = 0;
+    size_t lastRank = board->nextRank;
+    for (size_t rank = board->nextRank; rank < NUM_RANKS; ++rank)
+    {
+        const int partial = inDeck[rank] < board->remaining[rank];
+        if (partial && board->later)
+        {
+            break; // Some of this rank are still out, and a stable game can't found the rest before them
+        }
+        start[rank] = board->numCards[STACK_ORDERED] + placed;
+        placed += inDeck[rank];
+        lastRank = rank;
+        if (partial)
+        {
+            break;
+        }
+    }
+    if (placed == 0)
+    {
+        DrawHand(board);
+        return 0;
+    }
+
+    card_t *foundation = StackCards(board, STACK_ORDERED);
+    size_t kept = 0;
+    for (size_t k = 0, slot = board->deckHead, write = board->deckHead; k < numInDeck; ++k, slot = (slot + 1 == capacity) ? 0 : slot + 1)
+    {
+        const size_t rank = CardRank(deck[slot]);
+        if (rank >= board->nextRank && rank <= lastRank)
+        {
+            // A stable game has every card left of the rank here, so each one's place among them follows from its tag.
+            const size_t place = board->later ? start[rank] + board->remaining[rank] - 1 - board->later[CardTag(board, &deck[slot])] : start[rank]++;
+            CopyCards(board, &foundation[place], &deck[slot], 1);
+        }
+        else
+        {
+            CopyCards(board, &deck[write], &deck[slot], 1);
+            write = (write + 1 == capacity) ? 0 : write + 1;
+            ++kept;
+        }
+    }
+    board->numCards[STACK_DECK] = kept;
+    RehashDeck(board);
+
+    for (size_t rank = board->nextRank; rank <= lastRank; ++rank)
+    {
+        board->remaining[rank] -= inDeck[rank];
+    }
+    board->numCards[STACK_ORDERED] += placed;
+    board->top[STACK_ORDERED] = foundation[board->numCards[STACK_ORDERED] - 1];
+    while (board->nextRank < NUM_RANKS && board->remaining[board->nextRank] == 0)
+    {
+        ++board->nextRank;
+    }
+    if (board->trace)
+    {
+        TraceEvent(board, SOLITAIRE_EVENT_SWEEP, STACK_DECK, STACK_ORDERED, placed, board->top[STACK_ORDERED]);
+    }
+
+    DrawHand(board);
+    return placed;
+}
+
+/**
+ * @return A record to fill in, or NULL if the log could not grow.
+ */
+_Ret_maybenull_ UndoRecord *PushUndo(
+    _Inout_ Board *board)
+{
+    UndoLog *log = &board->log;
+    if (log->count == log->capacity)
+    {
+        const size_t capacity = log->capacity ? log->capacity * 2 : 256;
+        UndoRecord *records = (UndoRecord *)realloc(log->records, capacity * sizeof(UndoRecord));
+        if (!records)
+        {
+            return NULL;
+        }
+        log->records = records;
+        log->capacity = capacity;
+        ++board->allocations;
+        COUNT_EVENT(board, bytesAllocated, capacity * sizeof(UndoRecord));
+    }
+    return &log->records[log->count++];
+}
+
+/**
+ * Where to write down the move about to be made: the end of the log if logging, otherwise (scratch), which is thrown away.
+ * @return NULL if the log could not grow.
+ */
+_Ret_maybenull_ UndoRecord *NextUndo(
+    _Inout_ Board *board,
+    _Out_ UndoRecord *scratch)
+{
+    return board->logging ? PushUndo(board) : scratch;
+}
+
+void ApplyMove(
+    _Inout_ Board *board,
+    _In_ const Move *move,
+    _Out_ UndoRecord *record)
+{
+    record->src = move->src;
+    record->dest = move->dest;
+    record->srcVisible = board->visible[move->src];
+    record->srcMoveable = board->moveable[move->src];
+    record->destVisible = board->visible[move->dest];
+    record->destMoveable = board->moveable[move->dest];
+    record->count = move->src == STACK_HAND ? 1 : move->count;
+    record->handIndex = (unsigned char)(move->src == STACK_HAND ? move->count : 0);
+    if (board->trace)
+    {
+        const card_t *cards = StackCards(board, move->src);
+        const card_t card = move->src == STACK_HAND ? cards[move->count] : cards[board->numCards[move->src] - move->count];
+        TraceEvent(board, SOLITAIRE_EVENT_MOVE, move->src, move->dest, record->count, card);
+    }
+    ExecuteMove(board, move);
+    ++board->movesPlayed;
+    COUNT_EVENT(board, movesExecuted, 1);
+    COUNT_EVENT(board, transfers, move->src != STACK_HAND);
+}
+
+void ApplyDraw(
+    _Inout_ Board *board,
+    _Out_ UndoRecord *record)
+{
+    record->src = STACK_DECK;
+    record->dest = STACK_HAND;
+    record->srcVisible = board->visible[STACK_HAND];
+    record->handIndex = (unsigned char)board->numCards[STACK_HAND];
+    DrawHand(board);
+    ++board->movesPlayed;
+    COUNT_EVENT(board, draws, 1);
+    record->count = board->numCards[STACK_HAND];
+    if (board->trace)
+    {
+        TraceEvent(board, SOLITAIRE_EVENT_DRAW, STACK_DECK, STACK_HAND, record->count, record->count ? board->top[STACK_HAND] : 0);
+    }
+}
+
+/**
+ * Takes the top card off the foundation and hands it back to the dealer's tally.
+ */
+void UnfoundCard(
+    _Inout_ Board *board)
+{
+    const size_t rank = CardRank(board->top[STACK_ORDERED]);
+    PopFromStack(board, STACK_ORDERED, 1);
+    ++board->remaining[rank];
+    board->nextRank = rank < board->nextRank ? rank : board->nextRank;
+}
+
+/**
+ * Puts the board back exactly as it was before (record)'s move or draw.
+ */
+void Undo(
+    _Inout_ Board *board,
+    _In_ const UndoRecord *record)
+{
+    card_t *hand = StackCards(board, STACK_HAND);
+    if (board->trace)
+    {
+        // Whatever was moved is still on top of where it went.
+        const card_t card = record->src == STACK_DECK ? 0 : StackCards(board, record->dest)[board->numCards[record->dest] - record->count];
+        TraceEvent(board, SOLITAIRE_EVENT_UNDO, record->src, record->dest, record->count, card);
+    }
+    if (record->src == STACK_DECK)
+    {
+        // A draw slid the old hand under the deck and pulled the new one off the top. Do both backwards.
+        for (size_t i = 0; i < record->count; ++i)
+        {
+            PushOntoDeck(board, &hand[i]);
+        }
+        for (size_t i = 0; i < record->handIndex; ++i)
+        {
+            CopyCards(board, &hand[i], PullFromUnderDeck(board), 1);
+        }
+        board->numCards[STACK_HAND] = record->handIndex;
+        board->visible[STACK_HAND] = record->srcVisible;
+        if (record->handIndex != 0)
+        {
+            board->top[STACK_HAND] = hand[record->handIndex - 1];
+        }
+        return;
+    }
+
+    if (record->src == STACK_HAND)
+    {
+        if (record->dest == STACK_ORDERED)
+        {
+            UnfoundCard(board);
+        }
+        else
+        {
+            PopFromStack(board, record->dest, 1);
+        }
+        // Popping left the card where it was, just past the end of dest.
+        CopyCards(board, hand + record->handIndex + 1, hand + record->handIndex, board->numCards[STACK_HAND] - record->handIndex);
+        CopyCards(board, hand + record->handIndex, StackCards(board, record->dest) + board->numCards[record->dest], 1);
+        ++board->numCards[STACK_HAND];
+        board->top[STACK_HAND] = hand[board->numCards[STACK_HAND] - 1];
+    }
+    else
+    {
+        if (record->dest == STACK_ORDERED)
+        {
+            UnfoundCard(board);
+        }
+        else
+        {
+            PopFromStack(board, record->dest, record->count);
+        }
+        PushToStack(board, record->src, StackCards(board, record->dest), board->numCards[record->dest], record->count);
+        board->visible[record->src] = record->srcVisible;
+        board->moveable[record->src] = record->srcMoveable;
+    }
+    board->visible[record->dest] = record->destVisible;
+    board->moveable[record->dest] = record->destMoveable;
+}
+
+/**
+ * Takes moves back, newest first, until only the first (mark)-many in the log are left. Costs O(moves undone), never a re-deal.
+ */
+void Rewind(
+    _Inout_ Board *board,
+    const size_t mark)
+{
+    while (board->log.count > mark)
+    {
+        Undo(board, &board->log.records[--board->log.count]);
+    }
+}
+
+/**
+ * Puts the board back as it was straight after the deal, ready to play the same deal again some other way.
+ * The remembered states go too, since they were only repeats from the line that was just taken back.
+ */
+void RestartDeal(
+    _Inout_ Board *board)
+{
+    Rewind(board, 0);
+    memset(board->seen, 0, sizeof(board->seen));
+}
+
+/**
+ * Hashes the whole board: every stack's cards, and how many of each field stack's are face up.
+ * The foundation only ever holds the smallest cards in order, so its size says everything about it.
+ */
+uint64_t HashBoard(
+    _In_ const Board *board)
+{
+    uint64_t handHash = 0;
+    const card_t *hand = StackCards(board, STACK_HAND);
+    for (size_t i = 0; i < board->numCards[STACK_HAND]; ++i)
+    {
+        handHash = handHash * HASH_BASE + CardHash(board, &hand[i]);
+    }
+
+    uint64_t x = board->numCards[STACK_ORDERED];
+    uint64_t state = SplitMix64(&x);
+    for (size_t i = 0; i < NUM_STACKS; ++i)
+    {
+        if (i != STACK_ORDERED)
+        {
+            // Mixed once before the stack index goes in, or the same cards one stack over could cancel out.
+            x = (i == STACK_HAND ? handHash : board->hash[i]) ^ ((uint64_t)board->visible[i] << 32);
+            x = SplitMix64(&x) + i;
+            state ^= SplitMix64(&x);
+        }
+    }
+    return state;
+}
+
+/**
+ * Treat output as boolean. Remembers the current board state, and says whether it had been seen already this game.
+ * The engine always picks the same move from the same state, so a repeat would play out the same way forever.
+ * Slots are overwritten on collision, so only short cycles are caught here; long ones run into the stalled-draw limit instead.
+ */
+int RecordState(
+    _Inout_ Board *board)
+{
+    uint64_t state = HashBoard(board);
+    state += state == 0;
+    uint64_t *slot = &board->seen[state & (TRANSPOSITION_SIZE - 1)];
+    if (*slot == state)
+    {
+        COUNT_EVENT(board, cycles, 1);
+        return 1;
+    }
+    *slot = state;
+    return 0;
+}
+
+/**
+ * Selects and performs a move in the game. Allocates nothing unless logging; the move list lives on the stack.
+ * The counting-mode sweep can't be taken back, so it is skipped while logging.
+ * @param stalledDraws Draws in a row without any other move. A full pass through the deck like that means nothing can be done.
+ */
+int TryMakeMove(
+    _Inout_ Board *board,
+    const size_t size,
+    _Inout_ size_t *stalledDraws)
+{
+    if (board->numCards[STACK_ORDERED] == size)
+    {
+        return GAME_WIN;
+    }
+
+    MoveList list;
+    GenerateMoves(board, &list);
+    COUNT_EVENT(board, movesGenerated, list.numMoves);
+    UndoRecord scratch;
+
+    if (list.numMoves == 0)
+    {
+        if ((board->flags & SOLITAIRE_SORT_BULK_FOUNDATION) && !board->logging && board->sweptRank != board->nextRank && SweepDeckToFoundation(board) != 0)
+        {
+            ++board->movesPlayed;
+            *stalledDraws = 0;
+            return GAME_PLAYING;
+        }
+
+        const size_t cardsOutOfPlay = board->numCards[STACK_DECK] + board->numCards[STACK_HAND];
+        if (cardsOutOfPlay == 0 || *stalledDraws > cardsOutOfPlay / NUM_CARDS_IN_HAND + 1)
+        {
+            return GAME_LOSS;
+        }
+        UndoRecord *record = NextUndo(board, &scratch);
+        if (!record)
+        {
+            return GAME_LOSS;
+        }
+        record->stalledDraws = (*stalledDraws)++;
+        record->choice = (unsigned char)list.numMoves;
+        ApplyDraw(board, record);
+        return RecordState(board) ? GAME_LOSS : GAME_PLAYING;
+    }
+
+    UndoRecord *record = NextUndo(board, &scratch);
+    if (!record)
+    {
+        return GAME_LOSS;
+    }
+    record->stalledDraws = *stalledDraws;
+    record->choice = 0;
+    *stalledDraws = 0;
+    ApplyMove(board, &list.moves[list.best], record);
+    return RecordState(board) ? GAME_LOSS : GAME_PLAYING;
+}
+
+/**
+ * Treat output as boolean. A NULL flag can never be raised.
+ */
+int IsCancelled(
+    _In_opt_ AtomicInt *cancel)
+{
+    return cancel && AtomicLoad(cancel);
+}
+
+/**
+ * Treat output as boolean. Whether drawing is still worth trying, by the same measure as the greedy game's stalled-draw limit.
+ */
+int CanDraw(
+    _In_ const Board *board,
+    const size_t stalledDraws)
+{
+    const size_t cardsOutOfPlay = board->numCards[STACK_DECK] + board->numCards[STACK_HAND];
+    return cardsOutOfPlay != 0 && !(stalledDraws > cardsOutOfPlay / NUM_CARDS_IN_HAND + 1);
+}
+
+/**
+ * Plays option (choice) of the current state, where options are the generated moves best first followed by a draw.
+ * @return Whether there was such an option.
+ */
+int ApplyOption(
+    _Inout_ Board *board,
+    const size_t choice,
+    const size_t stalledDraws,
+    _Out_ UndoRecord *record)
+{
+    MoveList list;
+    GenerateMoves(board, &list);
+    COUNT_EVENT(board, movesGenerated, list.numMoves);
+    if (choice > list.numMoves || (choice == list.numMoves && !CanDraw(board, stalledDraws)))
+    {
+        return 0;
+    }
+    record->choice = (unsigned char)choice;
+    record->stalledDraws = stalledDraws;
+    if (choice == list.numMoves)
+    {
+        ApplyDraw(board, record);
+        return 1;
+    }
+
+    // Stable selection of the choice-th best move, so option 0 is always the move the greedy game would make.
+    size_t order[MAX_MOVES];
+    for (size_t i = 0; i < list.numMoves; ++i)
+    {
+        size_t j = i;
+        for (; j > 0 && list.moves[order[j - 1]].score < list.moves[i].score; --j)
+        {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+    ApplyMove(board, &list.moves[order[choice]], record);
+    return 1;
+}
+
+/**
+ * Depth-first search of the moves from the current deal, best-scored option first, so the first line tried is the greedy game.
+ * Dead ends and states already seen back up to the last point with an untried option, undoing moves rather than copying boards.
+ * The line that won is left in the board's log.
+ * Gives up once (board->searchBudget)-many moves have been taken back.
+ */
+_Success_(return == 0) int SearchGame(
+    _Inout_ Board *board,
+    const size_t size,
+    _In_opt_ AtomicInt *cancel,
+    _In_opt_ AtomicInt *abort)
+{
+    UndoLog *log = &board->log;
+    const size_t root = log->count;
+    const int logging = board->logging;
+    board->logging = 1;
+    size_t budget = board->searchBudget;
+    size_t choice = 0;
+    size_t stalledDraws = 0;
+    int result = 1;
+
+    while (!IsCancelled(cancel) && !IsCancelled(abort))
+    {
+        if (board->numCards[STACK_ORDERED] == size)
+        {
+            result = 0;
+            break;
+        }
+
+        UndoRecord *record = PushUndo(board);
+        if (!record)
+        {
+            break;
+        }
+        int advanced = 0;
+        while (ApplyOption(board, choice, stalledDraws, record))
+        {
+            if (!RecordState(board))
+            {
+                stalledDraws = record->src == STACK_DECK ? stalledDraws + 1 : 0;
+                choice = 0;
+                advanced = 1;
+                break;
+            }
+            Undo(board, record);
+            ++choice;
+        }
+        if (advanced)
+        {
+            continue;
+        }
+
+        // Out of options here: back up one move and try its next sibling.
+        --log->count;
+        if (log->count == root || budget == 0)
+        {
+            break;
+        }
+        --budget;
+        record = &log->records[--log->count];
+        Undo(board, record);
+        choice = (size_t)record->choice + 1;
+        stalledDraws = record->stalledDraws;
+    }
+
+    board->logging = logging;
+    return result;
+}
+
+/**
+ * Scalar fallback for FirstUnordered, and the tail end of the vector versions.
+ */
+size_t FirstUnorderedScalar(
+    _In_reads_(size) const card_t data[],
+    const size_t start,
+    const size_t size)
+{
+    for (size_t i = start; i < size; ++i)
+    {
+        if (data[i - 1] > data[i])
+        {
+            return i;
+        }
+    }
+    return size;
+}
+
+#if SOLITAIRE_SORT_X86
+/**
+ * Compares 32 adjacent pairs per iteration. Only ever called once the CPU has been checked for AVX2.
+ */
+SOLITAIRE_SORT_TARGET_AVX2 size_t FirstUnorderedAvx2(
+    _In_reads_(size) const card_t data[],
+    const size_t size)
+{
+    // AVX2 only has a signed byte compare, so unsigned chars get their sign bit flipped to order the same way.
+    const __m256i bias = _mm256_set1_epi8(CHAR_MIN == 0 ? (char)0x80 : 0);
+    size_t i = 1;
+    for (; i + 32 <= size; i += 32)
+    {
+        const __m256i below = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(data + i - 1)), bias);
+        const __m256i above = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(data + i)), bias);
+        const unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpgt_epi8(below, above));
+        if (mask)
+        {
+            return i + CountTrailingZeros(mask);
+        }
+    }
+    return FirstUnorderedScalar(data, i, size);
+}
+
+/**
+ * Treat output as boolean
+ */
+int CpuHasAvx2(void)
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return 0;
+    }
+    __cpuid(info, 1);
+    const int osSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return osSavesYmm && (info[1] & (1 << 5));
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+#if SOLITAIRE_SORT_NEON
+/**
+ * Compares 16 adjacent pairs per iteration. NEON is always there on AArch64, so no dispatch is needed.
+ */
+size_t FirstUnorderedNeon(
+    _In_reads_(size) const card_t data[],
+    const size_t size)
+{
+    size_t i = 1;
+    for (; i + 16 <= size; i += 16)
+    {
+#if CHAR_MIN == 0
+        const uint8x16_t gt = vcgtq_u8(vld1q_u8((const uint8_t *)data + i - 1), vld1q_u8((const uint8_t *)data + i));
+#else
+        const uint8x16_t gt = vcgtq_s8(vld1q_s8((const int8_t *)data + i - 1), vld1q_s8((const int8_t *)data + i));
+#endif
+        if (vmaxvq_u8(gt))
+        {
+            // No movemask on NEON. Finding the exact pair is rare enough to leave to the scalar loop.
+            return FirstUnorderedScalar(data, i, i + 16);
+        }
+    }
+    return FirstUnorderedScalar(data, i, size);
+}
+#endif
+
+// Constants
+enum
+{
+    KERNEL_UNRESOLVED = 0,
+    KERNEL_SCALAR,
+    KERNEL_AVX2,
+    KERNEL_NEON,
+};
+
+/**
+ * Picks the widest kernel the CPU supports.
+ */
+long SelectFirstUnordered(void)
+{
+#if SOLITAIRE_SORT_X86
+    if (CpuHasAvx2())
+    {
+        return KERNEL_AVX2;
+    }
+#endif
+#if SOLITAIRE_SORT_NEON
+    return KERNEL_NEON;
+#else
+    return KERNEL_SCALAR;
+#endif
+}
+
+size_t SolitaireSortFirstUnordered(
+    _In_reads_(size) const card_t data[],
+    const size_t size)
+{
+    // Every thread that gets here first resolves the same kernel, and the release store publishes it to the rest.
+    static AtomicInt resolved = KERNEL_UNRESOLVED;
+    long kernel = AtomicLoad(&resolved);
+    if (kernel == KERNEL_UNRESOLVED)
+    {
+        kernel = SelectFirstUnordered();
+        AtomicStore(&resolved, kernel);
+    }
+    switch (kernel)
+    {
+#if SOLITAIRE_SORT_X86
+    case KERNEL_AVX2:
+        return FirstUnorderedAvx2(data, size);
+#endif
+#if SOLITAIRE_SORT_NEON
+    case KERNEL_NEON:
+        return FirstUnorderedNeon(data, size);
+#endif
+    default:
+        return FirstUnorderedScalar(data, 1, size);
+    }
+}
+
+/**
+ * Treat output as boolean
+ */
+char CheckOrdered(
+    _In_reads_(size) const card_t data[],
+    const size_t size)
+{
+    return SolitaireSortFirstUnordered(data, size) >= size;
+}
+
+enum
+{
+    ORDER_NONE = 0,
+    ORDER_ASCENDING,  // Non-decreasing
+    ORDER_DESCENDING, // Strictly decreasing, so reversing it can't reorder equal cards
+};
+
+enum
+{
+    // Each block is compared without branching so the compiler can vectorize it; the early exit is only taken between blocks.
+    ORDER_CHECK_BLOCK = 64,
+};
+
+/**
+ * Works out whether the cards are already ascending, strictly descending, or neither.
+ */
+int ClassifyOrder(
+    _In_reads_(size) const card_t data[],
+    const size_t size)
+{
+    const size_t firstUnordered = SolitaireSortFirstUnordered(data, size);
+    if (firstUnordered >= size)
+    {
+        return ORDER_ASCENDING;
+    }
+    // Descending input breaks ascending order at the very first pair.
+    if (firstUnordered != 1)
+    {
+        return ORDER_NONE;
+    }
+
+    for (size_t i = 1; i < size; i += ORDER_CHECK_BLOCK)
+    {
+        const size_t end = (size - i < ORDER_CHECK_BLOCK) ? size : i + ORDER_CHECK_BLOCK;
+        int notDescending = 0;
+        for (size_t j = i; j < end; ++j)
+        {
+            notDescending |= data[j - 1] <= data[j];
+        }
+        if (notDescending)
+        {
+            return ORDER_NONE;
+        }
+    }
+    return ORDER_DESCENDING;
+}
+
+void ReverseCards(
+    _Inout_updates_all_(size) card_t data[],
+    const size_t size)
+{
+    for (size_t i = 0, j = size; i + 1 < j; ++i)
+    {
+        --j;
+        const card_t temp = data[i];
+        data[i] = data[j];
+        data[j] = temp;
+    }
+}
+
+/**
+ * Wall-clock time, only ever used for differences.
+ */
+uint64_t NowNanos(void)
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * Plays one game, shuffled by whatever board->rng was seeded with. Gives up early, as a loss, as soon as (cancel) or (abort) is raised.
+ * @param data The cards to deal. If NULL, the cards left on the board by the previous game are dealt again.
+ * @param abort The caller's own cancel token, if it gave one.
+ */
+_Success_(return == 0) int TrySort(
+    _Inout_ Board *board,
+    _In_reads_opt_(size) const card_t data[],
+    const size_t size,
+    _In_opt_ AtomicInt *cancel,
+    _In_opt_ AtomicInt *abort)
+{
+    if (IsCancelled(cancel) || IsCancelled(abort))
+    {
+        return 1;
+    }
+
+    if (data)
+    {
+        ResetBoard(board, data, size);
+    }
+    else
+    {
+        CollectCards(board, size);
+    }
+
+    ShuffleAndDeal(board);
+
+    if (board->searchBudget)
+    {
+        return SearchGame(board, size, cancel, abort) == 0 && CheckOrdered(StackCards(board, STACK_ORDERED), size) ? 0 : 1;
+    }
+
+    size_t stalledDraws = 0;
+    int status;
+    while ((status = TryMakeMove(board, size, &stalledDraws)) == GAME_PLAYING)
+    {
+        if (IsCancelled(cancel) || IsCancelled(abort))
+        {
+            return 1;
+        }
+    }
+
+    if (status != GAME_WIN)
+    {
+        return 1;
+    }
+    return CheckOrdered(StackCards(board, STACK_ORDERED), board->numCards[STACK_ORDERED]) ? 0 : 1;
+}
+
+/**
+ * Shared between every thread working on one deck.
+ */
+typedef struct
+{
+    _Field_size_(size) const card_t *data;
+    size_t size;
+    long maxRetries;
+    uint64_t seed;
+    unsigned flags;
+    size_t searchBudget;
+    SolitaireSortWeights weights;
+    /** Whether the single worker's foundation is data itself. Its retries then have to deal from what is left on the board. */
+    int inPlace;
+    /** Index of the next game to be started. Also picks that game's shuffle. */
+    AtomicInt nextGame;
+    /** Raised by whoever wins first. Everyone else stops at their next move. */
+    AtomicInt cancelled;
+    /** The caller's cancel token, or NULL. Stops every game just the same, but nobody here ever raises it. */
+    AtomicInt *abort;
+    /** Where the winning game is written down, or NULL. Its boards then log their moves, except in counting mode. */
+    SolitaireSortCatalog *catalog;
+    /** The input's key in the catalog. */
+    uint64_t fingerprint;
+
+} SortJob;
+
+long ResolveMaxRetries(
+    _In_opt_ const SolitaireSortOptions *options)
+{
+    const size_t maxRetries = (options && options->maxRetries) ? options->maxRetries : (size_t)MAX_RETRIES;
+    return maxRetries > LONG_MAX ? LONG_MAX : (long)maxRetries;
+}
+
+SolitaireSortWeights ResolveWeights(
+    _In_opt_ const SolitaireSortOptions *options)
+{
+    return (options && options->weights) ? *options->weights : DEFAULT_WEIGHTS;
+}
+
+uint64_t ResolveSeed(
+    _In_opt_ const SolitaireSortOptions *options)
+{
+    return (options && options->seed) ? options->seed : (uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)&options;
+}
+
+void ConstructSortJob(
+    _Out_ SortJob *job,
+    _In_reads_(size) const card_t data[],
+    const size_t size,
+    _In_opt_ const SolitaireSortOptions *options,
+    const uint64_t seed,
+    const int inPlace)
+{
+    job->data = data;
+    job->size = size;
+    job->maxRetries = ResolveMaxRetries(options);
+    job->seed = seed;
+    job->flags = options ? options->flags : 0;
+    job->searchBudget = options ? options->searchBudget : 0;
+    job->weights = ResolveWeights(options);
+    job->inPlace = inPlace;
+    job->nextGame = 0;
+    job->cancelled = 0;
+    job->abort = (options && options->cancel) ? &options->cancel->raised : NULL;
+    job->catalog = NULL;
+    job->fingerprint = 0;
+}
+
+/**
+ * One thread's share of a SortJob. Each has a board to itself so games never contend on anything but the two counters.
+ */
+typedef struct
+{
+    SortJob *job;
+    Board *board;
+    /** Set if this worker's board holds the winning game. */
+    int won;
+    /** Which game that was. */
+    long game;
+    size_t gamesPlayed;
+    /** Time spent inside games, as opposed to waiting on the others. */
+    uint64_t busyNanos;
+
+} SortWorker;
+
+/**
+ * Keeps starting games until one is won by anybody or the retries run out.
+ * The winning board is left intact; unless the foundation is data itself, nothing is written to the caller's data here,
+ * since other workers may still be dealing from it.
+ */
+void RunSortWorker(
+    _Inout_ SortWorker *worker)
+{
+    SortJob *job = worker->job;
+    Board *board = worker->board;
+    worker->won = 0;
+    board->flags = job->flags;
+    board->searchBudget = job->searchBudget;
+    board->weights = &job->weights;
+    board->logging = job->catalog && !(job->flags & SOLITAIRE_SORT_BULK_FOUNDATION);
+
+    long game;
+    int played = 0;
+    while (!IsCancelled(&job->cancelled) && !IsCancelled(job->abort) && (game = AtomicFetchAdd(&job->nextGame, 1)) < job->maxRetries)
+    {
+        SeedRng(&board->rng, job->seed, (uint64_t)game);
+        const card_t *source = (job->inPlace && played) ? NULL : job->data;
+        played = 1;
+        ++worker->gamesPlayed;
+        COUNT_EVENT(board, retries, game != 0);
+        if (board->trace)
+        {
+            TraceEvent(board, SOLITAIRE_EVENT_DEAL, STACK_DECK, STACK_FIELD, (size_t)game, 0);
+        }
+        const uint64_t start = NowNanos();
+        const int result = TrySort(board, source, job->size, &job->cancelled, job->abort);
+        worker->busyNanos += NowNanos() - start;
+        if (board->trace)
+        {
+            TraceEvent(board, SOLITAIRE_EVENT_GAME_OVER, STACK_ORDERED, STACK_ORDERED, (size_t)result, 0);
+        }
+        if (result == 0 && AtomicCompareExchange(&job->cancelled, 0, 1))
+        {
+            worker->won = 1;
+            worker->game = game;
+            return;
+        }
+    }
+}
+
+THREAD_PROC(SortWorkerThread)
+{
+    RunSortWorker((SortWorker *)arg);
+    THREAD_RETURN;
+}
+
+size_t SolitaireSortScratchSize(
+    const size_t size)
+{
+    return BoardArenaSize(size, 0);
+}
+
+// Constants
+enum
+{
+    HYBRID_INSERTION_THRESHOLD = NUM_FIELD_STACKS * (NUM_FIELD_STACKS + 1) / 2, // Any fewer and the deal can't fill the field
+    HYBRID_MERGE_THRESHOLD = 1024, // Where solitaire-sort-bench --calibrate first found chunking faster
+    HYBRID_CHUNK_SIZE = 512,
+};
+
+size_t ResolveInsertionThreshold(
+    _In_opt_ const SolitaireSortOptions *options)
+{
+    return (options && options->insertionThreshold) ? options->insertionThreshold : (size_t)HYBRID_INSERTION_THRESHOLD;
+}
+
+size_t ResolveMergeThreshold(
+    _In_opt_ const SolitaireSortOptions *options)
+{
+    if (options && options->mergeThreshold)
+    {
+        return options->mergeThreshold;
+    }
+    return (options && (options->flags & SOLITAIRE_SORT_BULK_FOUNDATION)) ? SIZE_MAX : (size_t)HYBRID_MERGE_THRESHOLD;
+}
+
+size_t ResolveChunkSize(
+    _In_opt_ const SolitaireSortOptions *options)
+{
+    return (options && options->chunkSize) ? options->chunkSize : (size_t)HYBRID_CHUNK_SIZE;
+}
+
+/**
+ * Plain insertion sort, for decks too small to be worth a board.
+ */
+void InsertionSortCards(
+    _Inout_updates_all_(size) card_t data[],
+    const size_t size)
+{
+    for (size_t i = 1; i < size; ++i)
+    {
+        const card_t card = data[i];
+        size_t j = i;
+        for (; j > 0 && data[j - 1] > card; --j)
+        {
+            data[j] = data[j - 1];
+        }
+        data[j] = card;
+    }
+}
+
+/**
+ * Handles input that needs no game at all: already in order, strictly descending, or too small to fill the field.
+ * @return SOLITAIRE_PATH_GAME if the cards still need sorting.
+ */
+SolitaireSortPath TakeFastPath(
+    _Inout_updates_all_(size) card_t data[],
+    const size_t size,
+    _In_opt_ const SolitaireSortOptions *options)
+{
+    switch (ClassifyOrder(data, size))
+    {
+    case ORDER_ASCENDING:
+        return SOLITAIRE_PATH_ALREADY_SORTED;
+
+    case ORDER_DESCENDING:
+        ReverseCards(data, size);
+        return SOLITAIRE_PATH_REVERSED;
+    }
+    if (size < ResolveInsertionThreshold(options))
+    {
+        InsertionSortCards(data, size);
+        return SOLITAIRE_PATH_INSERTION;
+    }
+    return SOLITAIRE_PATH_GAME;
+}
+
+void AddCounters(
+    _Inout_ SolitaireSortCounters *total,
+    _In_ const SolitaireSortCounters *counters)
+{
+    total->movesGenerated += counters->movesGenerated;
+    total->movesExecuted += counters->movesExecuted;
+    total->transfers += counters->transfers;
+    total->reveals += counters->reveals;
+    total->draws += counters->draws;
+    total->retries += counters->retries;
+    total->cycles += counters->cycles;
+    total->bytesAllocated += counters->bytesAllocated;
+}
+
+/**
+ * Adds what a board has counted to the call's stats. Do this before the board is destructed.
+ */
+void TallyBoard(
+    _In_ const Board *board,
+    _Inout_ SolitaireSortStats *stats)
+{
+    stats->movesPlayed += board->movesPlayed;
+    stats->allocations += board->allocations;
+    AddCounters(&stats->counters, &board->counters);
+}
+
+/**
+ * Plays every game on the calling thread with data itself as the foundation, so nothing is copied back at the end.
+ * The board can be one kept from an earlier deck, as long as it was built for at least (job->size) cards without a foundation of its own.
+ */
+_Success_(return == 0) int SortInPlace(
+    _Inout_ Board *board,
+    _Inout_ SortJob *job,
+    _Inout_updates_all_(size) card_t data[],
+    const size_t size,
+    _Inout_ size_t *gamesPlayed)
+{
+    board->cards[STACK_ORDERED] = data;
+
+    SortWorker worker;
+    worker.job = job;
+    worker.board = board;
+    worker.won = 0;
+    worker.gamesPlayed = 0;
+    worker.busyNanos = 0;
+    RunSortWorker(&worker);
+    *gamesPlayed += worker.gamesPlayed;
+
+    if (!worker.won)
+    {
+        // The foundation is part of data, so put every card back rather than leave it half played.
+        CollectCards(board, size);
+        memcpy(data, StackCards(board, STACK_DECK), size);
+    }
+    return worker.won ? 0 : 1;
+}
+
+// Constants
+enum
+{
+    PACKED_MAX_CARDS = 64,
+    PACKED_MAX_RANKS = 16, // Every card fits in 4 bits
+    PACKED_WORDS = PACKED_MAX_CARDS / 16, // Words of 4-bit cards per stack
+    PACKED_TRANSPOSITION_SIZE = 64, // A 64-card game has few enough states that short cycles are all this one needs to catch
+};
+
+/** One byte per field stack, for spreading a per-stack mask over every rank of a top bitboard. */
+#define PACKED_LANES 0x0101010101010101ull
+
+/**
+ * A small deck over few distinct cards, squeezed down to 4-bit ranks ready for a PackedBoard.
+ */
+typedef struct
+{
+    /** The deck in its original order, card i in bits 4 * (i % 16) up of word i / 16. */
+    uint64_t cards[PACKED_WORDS];
+    /** The card each rank stands for, smallest first. */
+    card_t values[PACKED_MAX_RANKS];
+    uint8_t counts[PACKED_MAX_RANKS];
+    size_t size;
+
+} PackedDeck;
+
+/**
+ * The same game as Board plays, for decks that fit in a PackedDeck, with no arena and no allocation at all.
+ * Every stack is PACKED_WORDS words of 4-bit ranks, bottom card first. The foundation isn't kept, since its cards go straight
+ * into the caller's buffer. The counts, runs and top bitboard a move scan reads share the first cache line.
+ */
+typedef struct
+{
+    uint8_t numCards[NUM_STACKS];
+    uint8_t visible[NUM_STACKS];
+    uint8_t moveable[NUM_STACKS];
+    uint8_t nextRank;
+    /** Bit i set if field stack i is empty. */
+    uint8_t emptyField;
+    /**
+     * Bitboard of the field's top cards. Bit 8 * rank + i is set if field stack i has that rank on top, ranks 8 and up in the second word.
+     * The lowest set bit at or above a rank is then the stack with the smallest top that will take it, lowest stack first on a tie.
+     */
+    uint64_t tops[2];
+    uint8_t remaining[PACKED_MAX_RANKS];
+
+    uint64_t cards[STACK_ORDERED][PACKED_WORDS];
+    /** Where the foundation's cards go, translated back from ranks. */
+    card_t *foundation;
+    const card_t *values;
+    const SolitaireSortWeights *weights;
+    uint64_t seen[PACKED_TRANSPOSITION_SIZE];
+    Rng rng;
+    size_t movesPlayed;
+    SolitaireSortCounters counters;
+
+} PackedBoard;
+
+/**
+ * Treat output as boolean. Packs (data) if it is small enough and has few enough distinct cards.
+ */
+int PackDeck(
+    _Out_ PackedDeck *deck,
+    _In_reads_(size) const card_t data[],
+    const size_t size)
+{
+    if (size > PACKED_MAX_CARDS)
+    {
+        return 0;
+    }
+
+    uint8_t present[NUM_RANKS] = {0};
+    for (size_t i = 0; i < size; ++i)
+    {
+        present[CardRank(data[i])] = 1;
+    }
+    size_t numRanks = 0;
+    for (size_t i = 0; i < NUM_RANKS; ++i)
+    {
+        if (present[i])
+        {
+            if (numRanks == PACKED_MAX_RANKS)
+            {
+                return 0;
+            }
+            deck->values[numRanks] = (card_t)((int)i + CHAR_MIN);
+            deck->counts[numRanks] = 0;
+            present[i] = (uint8_t)numRanks++;
+        }
+    }
+
+    memset(deck->cards, 0, sizeof(deck->cards));
+    for (size_t i = 0; i < size; ++i)
+    {
+        const size_t rank = present[CardRank(data[i])];
+        deck->cards[i >> 4] |= (uint64_t)rank << ((i & 15) * 4);
+        ++deck->counts[rank];
+    }
+    deck->size = size;
+    return 1;
+}
+
+size_t PackedCard(
+    _In_ const PackedBoard *board,
+    const size_t stack,
+    const size_t index)
+{
+    return (size_t)(board->cards[stack][index >> 4] >> ((index & 15) * 4)) & 15;
+}
+
+size_t PackedTop(
+    _In_ const PackedBoard *board,
+    const size_t stack)
+{
+    return PackedCard(board, stack, board->numCards[stack] - 1u);
+}
+
+void PackedPush(
+    _Inout_ PackedBoard *board,
+    const size_t stack,
+    const size_t rank)
+{
+    const size_t index = board->numCards[stack]++;
+    board->cards[stack][index >> 4] |= (uint64_t)rank << ((index & 15) * 4);
+}
+
+/**
+ * Clears the slot as well, so the words of a stack only ever hold its cards and can be hashed as they are.
+ */
+size_t PackedPop(
+    _Inout_ PackedBoard *board,
+    const size_t stack)
+{
+    const size_t index = --board->numCards[stack];
+    const size_t rank = PackedCard(board, stack, index);
+    board->cards[stack][index >> 4] &= ~((uint64_t)15 << ((index & 15) * 4));
+    return rank;
+}
+
+/**
+ * Slides a card underneath the deck, shifting the whole deck up one card.
+ */
+void PackedPushUnderDeck(
+    _Inout_ PackedBoard *board,
+    const size_t rank)
+{
+    uint64_t *deck = board->cards[STACK_DECK];
+    for (size_t w = PACKED_WORDS - 1; w > 0; --w)
+    {
+        deck[w] = (deck[w] << 4) | (deck[w - 1] >> 60);
+    }
+    deck[0] = (deck[0] << 4) | rank;
+    ++board->numCards[STACK_DECK];
+}
+
+/**
+ * Brings a field stack's bit in the top bitboard up to date after its top card changes.
+ */
+void PackedUpdateTop(
+    _Inout_ PackedBoard *board,
+    const size_t stack)
+{
+    const size_t lane = stack - STACK_FIELD;
+    board->tops[0] &= ~(PACKED_LANES << lane);
+    board->tops[1] &= ~(PACKED_LANES << lane);
+    if (board->numCards[stack] == 0)
+    {
+        board->emptyField |= (uint8_t)(1u << lane);
+        return;
+    }
+    board->emptyField &= (uint8_t)~(1u << lane);
+    const size_t rank = PackedTop(board, stack);
+    board->tops[rank >> 3] |= (uint64_t)1 << ((rank & 7) * 8 + lane);
+}
+
+/**
+ * Same as DrawHand.
+ */
+void PackedDrawHand(
+    _Inout_ PackedBoard *board)
+{
+    while (board->numCards[STACK_HAND] != 0)
+    {
+        PackedPushUnderDeck(board, PackedPop(board, STACK_HAND));
+    }
+
+    const size_t count = board->numCards[STACK_DECK] < NUM_CARDS_IN_HAND ? board->numCards[STACK_DECK] : (size_t)NUM_CARDS_IN_HAND;
+    uint64_t hand = 0;
+    for (size_t i = count; i > 0; --i)
+    {
+        hand |= (uint64_t)PackedPop(board, STACK_DECK) << ((i - 1) * 4);
+    }
+    board->cards[STACK_HAND][0] = hand;
+    board->numCards[STACK_HAND] = (uint8_t)count;
+    board->visible[STACK_HAND] = (uint8_t)count;
+}
+
+/**
+ * Same as Shuffle, drawing the same numbers, so a packed game deals exactly what Board would from the same deck and seed.
+ */
+void PackedShuffle(
+    _Inout_ PackedBoard *board)
+{
+    uint64_t *deck = board->cards[STACK_DECK];
+    for (size_t i = board->numCards[STACK_DECK]; i > 1; --i)
+    {
+        const size_t j = RandBetween(&board->rng, 0, i - 1);
+        const size_t a = i - 1;
+        const uint64_t rankA = (deck[a >> 4] >> ((a & 15) * 4)) & 15;
+        const uint64_t rankJ = (deck[j >> 4] >> ((j & 15) * 4)) & 15;
+        deck[a >> 4] ^= (rankA ^ rankJ) << ((a & 15) * 4);
+        deck[j >> 4] ^= (rankA ^ rankJ) << ((j & 15) * 4);
+    }
+}
+
+/**
+ * Sets up game (game) of (deck): shuffles it the way that game always is, then deals.
+ */
+void PackedDeal(
+    _Out_ PackedBoard *board,
+    _In_ const PackedDeck *deck,
+    _Out_writes_(deck->size) card_t foundation[],
+    const uint64_t seed,
+    const uint64_t game)
+{
+    memset(board->numCards, 0, sizeof(board->numCards));
+    memset(board->visible, 0, sizeof(board->visible));
+    memset(board->moveable, 0, sizeof(board->moveable));
+    memset(board->cards, 0, sizeof(board->cards));
+    memset(board->seen, 0, sizeof(board->seen));
+    memcpy(board->cards[STACK_DECK], deck->cards, sizeof(deck->cards));
+    memcpy(board->remaining, deck->counts, sizeof(deck->counts));
+    board->numCards[STACK_DECK] = (uint8_t)deck->size;
+    board->nextRank = 0; // Rank 0 is always in the deck, that's what made it rank 0
+    board->foundation = foundation;
+    board->values = deck->values;
+    SeedRng(&board->rng, seed, game);
+    PackedShuffle(board);
+
+    for (size_t i = 0; i < NUM_FIELD_STACKS; ++i)
+    {
+        const size_t stack = STACK_FIELD + i;
+        for (size_t j = 0; j <= i && board->numCards[STACK_DECK] != 0; ++j)
+        {
+            PackedPush(board, stack, PackedPop(board, STACK_DECK));
+        }
+        board->visible[stack] = board->numCards[stack] != 0;
+        board->moveable[stack] = board->visible[stack];
+        PackedUpdateTop(board, stack);
+    }
+    PackedDrawHand(board);
+}
+
+/**
+ * Same as BestDestination, answered off the top bitboard rather than by comparing every top.
+ */
+size_t PackedBestDestination(
+    _In_ const PackedBoard *board,
+    const size_t bottom,
+    const size_t exclude,
+    const int allowEmpty)
+{
+    const unsigned excluded = IsFieldStack(exclude) ? 1u << (exclude - STACK_FIELD) : 0;
+    const uint64_t allowed = (uint64_t)(0xFFu & ~excluded) * PACKED_LANES;
+    const uint64_t low = bottom < 8 ? board->tops[0] & allowed & (~0ull << (bottom * 8)) : 0;
+    const uint64_t high = board->tops[1] & allowed & (bottom < 8 ? ~0ull : ~0ull << ((bottom - 8) * 8));
+    if (low | high)
+    {
+        return STACK_FIELD + (CountTrailingZeros64(low ? low : high) & 7);
+    }
+
+    const unsigned empty = board->emptyField & ~excluded;
+    return (allowEmpty && empty) ? STACK_FIELD + CountTrailingZeros(empty) : (size_t)NUM_STACKS;
+}
+
+/**
+ * Same as GenerateMoves, move for move and score for score.
+ */
+void PackedGenerateMoves(
+    _In_ const PackedBoard *board,
+    _Out_ MoveList *list)
+{
+    list->numMoves = 0;
+    list->best = 0;
+
+    for (size_t src = STACK_FIELD; src < STACK_FIELD + NUM_FIELD_STACKS; ++src)
+    {
+        const size_t numCards = board->numCards[src];
+        const size_t run = board->moveable[src];
+        if (numCards == 0)
+        {
+            continue;
+        }
+
+        if (PackedTop(board, src) == board->nextRank)
+        {
+            OfferMove(list, src, STACK_ORDERED, 1, board->weights->foundFromField);
+        }
+        else if (run == board->visible[src] && run != numCards)
+        {
+            const size_t dest = PackedBestDestination(board, PackedCard(board, src, numCards - run), src, 1);
+            if (dest != NUM_STACKS)
+            {
+                OfferMove(list, src, dest, run, RevealScore(board->weights, numCards - run));
+            }
+        }
+        else if (run == numCards)
+        {
+            const size_t dest = PackedBestDestination(board, PackedCard(board, src, 0), src, 0);
+            if (dest != NUM_STACKS)
+            {
+                OfferMove(list, src, dest, run, board->weights->merge);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < board->numCards[STACK_HAND]; ++i)
+    {
+        const size_t rank = PackedCard(board, STACK_HAND, i);
+        if (rank == board->nextRank)
+        {
+            OfferMove(list, STACK_HAND, STACK_ORDERED, i, board->weights->foundFromHand);
+            continue;
+        }
+        const size_t dest = PackedBestDestination(board, rank, NUM_STACKS, 1);
+        if (dest != NUM_STACKS)
+        {
+            OfferMove(list, STACK_HAND, dest, i, board->numCards[dest] != 0 ? board->weights->handToStack : board->weights->handToEmpty);
+        }
+    }
+}
+
+/**
+ * Same as PlaceCards, for one card.
+ */
+void PackedPlace(
+    _Inout_ PackedBoard *board,
+    const size_t dest,
+    const size_t rank)
+{
+    if (dest == STACK_ORDERED)
+    {
+        board->foundation[board->numCards[STACK_ORDERED]++] = board->values[rank];
+        --board->remaining[rank];
+        while (board->nextRank < PACKED_MAX_RANKS && board->remaining[board->nextRank] == 0)
+        {
+            ++board->nextRank;
+        }
+        return;
+    }
+
+    const int continuesRun = board->moveable[dest] != 0 && !(rank > PackedTop(board, dest));
+    board->moveable[dest] = (uint8_t)(continuesRun ? board->moveable[dest] + 1u : 1u);
+    ++board->visible[dest];
+    PackedPush(board, dest, rank);
+    PackedUpdateTop(board, dest);
+}
+
+void PackedExecuteMove(
+    _Inout_ PackedBoard *board,
+    _In_ const Move *move)
+{
+    if (move->src == STACK_HAND)
+    {
+        // Hand cards above the one taken shift down a slot.
+        uint64_t *hand = &board->cards[STACK_HAND][0];
+        const size_t shift = move->count * 4;
+        const size_t rank = (size_t)(*hand >> shift) & 15;
+        *hand = (*hand & (((uint64_t)1 << shift) - 1)) | ((*hand >> (shift + 4)) << shift);
+        --board->numCards[STACK_HAND];
+        --board->visible[STACK_HAND];
+        PackedPlace(board, move->dest, rank);
+        return;
+    }
+
+    const size_t src = move->src;
+    const size_t first = board->numCards[src] - move->count;
+    for (size_t i = 0; i < move->count; ++i)
+    {
+        PackedPlace(board, move->dest, PackedCard(board, src, first + i));
+    }
+    for (size_t i = 0; i < move->count; ++i)
+    {
+        PackedPop(board, src);
+    }
+    board->visible[src] = (uint8_t)(board->visible[src] - move->count);
+    board->moveable[src] = (uint8_t)(board->moveable[src] - move->count);
+    if (board->visible[src] == 0 && board->numCards[src] != 0)
+    {
+        board->visible[src] = 1;
+        board->moveable[src] = 1;
+        COUNT_EVENT(board, reveals, 1);
+    }
+    PackedUpdateTop(board, src);
+    COUNT_EVENT(board, transfers, 1);
+}
+
+/**
+ * Same as RecordState. The stacks' words hold nothing but their cards, so they are hashed as they stand.
+ */
+int PackedRecordState(
+    _Inout_ PackedBoard *board)
+{
+    // Every step is invertible and the rotate feeds the high bits back down, so one full mix at the end is enough.
+    uint64_t x = board->numCards[STACK_ORDERED];
+    for (size_t stack = 0; stack < STACK_ORDERED; ++stack)
+    {
+        x = RotateLeft((x ^ (((uint64_t)board->numCards[stack] << 8) | board->visible[stack])) * HASH_BASE, 29);
+        for (size_t w = 0; w < (board->numCards[stack] + 15u) / 16u; ++w)
+        {
+            x = RotateLeft((x ^ board->cards[stack][w]) * HASH_BASE, 29);
+        }
+    }
+    uint64_t state = SplitMix64(&x);
+    state += state == 0;
+
+    uint64_t *slot = &board->seen[state & (PACKED_TRANSPOSITION_SIZE - 1)];
+    if (*slot == state)
+    {
+        COUNT_EVENT(board, cycles, 1);
+        return 1;
+    }
+    *slot = state;
+    return 0;
+}
+
+/**
+ * Same as TryMakeMove, less the logging and the counting-mode sweep: a deck this small has nothing to gain from it.
+ */
+int PackedTryMakeMove(
+    _Inout_ PackedBoard *board,
+    const size_t size,
+    _Inout_ size_t *stalledDraws)
+{
+    if (board->numCards[STACK_ORDERED] == size)
+    {
+        return GAME_WIN;
+    }
+
+    MoveList list;
+    PackedGenerateMoves(board, &list);
+    COUNT_EVENT(board, movesGenerated, list.numMoves);
+
+    if (list.numMoves == 0)
+    {
+        const size_t cardsOutOfPlay = board->numCards[STACK_DECK] + board->numCards[STACK_HAND];
+        if (cardsOutOfPlay == 0 || *stalledDraws > cardsOutOfPlay / NUM_CARDS_IN_HAND + 1)
+        {
+            return GAME_LOSS;
+        }
+        ++*stalledDraws;
+        PackedDrawHand(board);
+        ++board->movesPlayed;
+        COUNT_EVENT(board, draws, 1);
+    }
+    else
+    {
+        *stalledDraws = 0;
+        PackedExecuteMove(board, &list.moves[list.best]);
+        ++board->movesPlayed;
+        COUNT_EVENT(board, movesExecuted, 1);
+    }
+    return PackedRecordState(board) ? GAME_LOSS : GAME_PLAYING;
+}
+
+/**
+ * Plays up to job->maxRetries games of a packed deck on the calling thread, straight into (data).
+ * Only the input and the foundation are ever bytes, so a lost call puts the input back exactly as it was.
+ */
+_Success_(return == 0) int SortPacked(
+    _In_ const PackedDeck *deck,
+    _In_ const SortJob *job,
+    _Inout_updates_all_(deck->size) card_t data[],
+    _Inout_ SolitaireSortStats *stats)
+{
+    PackedBoard board;
+    memset(&board.counters, 0, sizeof(board.counters));
+    board.movesPlayed = 0;
+    board.weights = &job->weights;
+
+    int result = 1;
+    for (long game = 0; game < job->maxRetries && result != 0 && !IsCancelled(job->abort); ++game)
+    {
+        COUNT_EVENT(&board, retries, game != 0);
+        ++stats->gamesPlayed;
+        PackedDeal(&board, deck, data, job->seed, (uint64_t)game);
+
+        size_t stalledDraws = 0;
+        int status;
+        while ((status = PackedTryMakeMove(&board, deck->size, &stalledDraws)) == GAME_PLAYING)
+        {
+        }
+        result = (status == GAME_WIN && CheckOrdered(data, deck->size)) ? 0 : 1;
+    }
+
+    if (result != 0)
+    {
+        for (size_t i = 0; i < deck->size; ++i)
+        {
+            data[i] = deck->values[(deck->cards[i >> 4] >> ((i & 15) * 4)) & 15];
+        }
+    }
+    stats->movesPlayed += board.movesPlayed;
+    AddCounters(&stats->counters, &board.counters);
+    return result;
+}
+
+/**
+ * Treat output as boolean. Whether a single-threaded sort with these options should try a PackedBoard first.
+ * Searching and tracing need the full Board.
+ */
+int WantsPacked(
+    _In_opt_ const SolitaireSortOptions *options)
+{
+    return options && (options->flags & SOLITAIRE_SORT_PACKED) && !options->searchBudget && !options->traces;
+}
+
+/**
+ * The event ring for thread (thread) of a call, or NULL if none were given.
+ */
+_Ret_maybenull_ SolitaireSortTrace *ThreadTrace(
+    _In_opt_ const SolitaireSortOptions *options,
+    const size_t thread)
+{
+    return (options && options->traces) ? &options->traces[thread] : NULL;
+}
+
+/**
+ * Fills in options->threadStats, if asked for, for a call that started at (callStart).
+ * Threads that never got going are reported as zeroes.
+ */
+void ReportThreadStats(
+    _In_opt_ const SolitaireSortOptions *options,
+    const size_t numThreads,
+    const SolitaireSortThreadStats threadStats[],
+    const uint64_t callStart)
+{
+    if (!options || !options->threadStats)
+    {
+        return;
+    }
+    const size_t requested = options->numThreads ? options->numThreads : 1;
+    const uint64_t wallNanos = NowNanos() - callStart;
+    for (size_t i = 0; i < requested; ++i)
+    {
+        if (i < numThreads)
+        {
+            options->threadStats[i] = threadStats[i];
+            options->threadStats[i].wallNanos = wallNanos;
+        }
+        else
+        {
+            memset(&options->threadStats[i], 0, sizeof(SolitaireSortThreadStats));
+        }
+    }
+}
+
+/**
+ * One move or draw of a won game, out of its undo log: as much of the UndoRecord as it takes to make the move again.
+ */
+typedef struct
+{
+    /** Cards moved. Unused for draws and for moves out of the hand. */
+    uint32_t count;
+    /** STACK_DECK for a draw. */
+    uint8_t src;
+    uint8_t dest;
+    /** Which card of the hand was played. */
+    uint8_t handIndex;
+
+} CatalogStep;
+
+/**
+ * What the catalog remembers about one input. An empty slot has a size of 0, which never gets as far as a game.
+ */
+typedef struct
+{
+    uint64_t fingerprint;
+    uint64_t size;
+    /** The winning game was shuffled from (seed, game). */
+    uint64_t seed;
+    uint64_t game;
+    /** 0 if the game couldn't be logged, in which case it is played again instead. */
+    uint64_t numSteps;
+    _Field_size_(numSteps) CatalogStep *steps;
+
+} CatalogEntry;
+
+/**
+ * Direct-mapped on the fingerprint, like the board's table of seen states, so a lookup is one probe and it never grows.
+ */
+struct SolitaireSortCatalog
+{
+    size_t capacity;
+    _Field_size_(capacity) CatalogEntry *entries;
+};
+
+// Constants
+enum
+{
+    CATALOG_DEFAULT_CAPACITY = 64,
+};
+
+/**
+ * What the catalog knows an input by. Covers everything a game's moves depend on besides the seed: the cards, and how they are played.
+ */
+uint64_t FingerprintDeck(
+    _In_reads_(size) const card_t data[],
+    const size_t size,
+    _In_ const SortJob *job)
+{
+    uint64_t hash = ((uint64_t)size * HASH_BASE ^ job->flags) * HASH_BASE ^ job->searchBudget;
+    int weights[sizeof(SolitaireSortWeights) / sizeof(int)];
+    memcpy(weights, &job->weights, sizeof(weights));
+    for (size_t i = 0; i < sizeof(weights) / sizeof(weights[0]); ++i)
+    {
+        hash = RotateLeft((hash ^ (uint32_t)weights[i]) * HASH_BASE, 31);
+    }
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = RotateLeft((hash ^ word) * HASH_BASE, 31);
+    }
+    for (; i < size; ++i)
+    {
+        hash = RotateLeft((hash ^ (uint8_t)data[i]) * HASH_BASE, 31);
+    }
+    return SplitMix64(&hash);
+}
+
+CatalogEntry *CatalogSlot(
+    _In_ const SolitaireSortCatalog *catalog,
+    const uint64_t fingerprint)
+{
+    return &catalog->entries[fingerprint % catalog->capacity];
+}
+
+_Ret_maybenull_ CatalogEntry *FindCatalogEntry(
+    _In_ const SolitaireSortCatalog *catalog,
+    const uint64_t fingerprint,
+    const size_t size)
+{
+    CatalogEntry *entry = CatalogSlot(catalog, fingerprint);
+    return (entry->size == size && entry->fingerprint == fingerprint) ? entry : NULL;
+}
+
+/**
+ * Empties a slot, freeing its steps.
+ */
+void ForgetCatalogEntry(
+    _Inout_ CatalogEntry *entry)
+{
+    free(entry->steps);
+    memset(entry, 0, sizeof(*entry));
+}
+
+/**
+ * Writes down a job's winning game, with the moves out of the board's log if it kept one. A catalog that can't get the memory just doesn't learn it.
+ * @return How many allocations were made, for the call's stats.
+ */
+size_t RecordWin(
+    _In_ const SortJob *job,
+    _In_ const Board *board,
+    const long game)
+{
+    const size_t numSteps = board->logging || board->searchBudget ? board->log.count : 0;
+    CatalogStep *steps = NULL;
+    if (numSteps != 0)
+    {
+        steps = (CatalogStep *)malloc(numSteps * sizeof(CatalogStep));
+        if (!steps)
+        {
+            return 0;
+        }
+        for (size_t i = 0; i < numSteps; ++i)
+        {
+            const UndoRecord *record = &board->log.records[i];
+            if (record->count > UINT32_MAX)
+            {
+                // Too big to write down. Playing the shuffle again still skips the retries.
+                free(steps);
+                steps = NULL;
+                break;
+            }
+            steps[i].count = (uint32_t)record->count;
+            steps[i].src = record->src;
+            steps[i].dest = record->dest;
+            steps[i].handIndex = record->handIndex;
+        }
+    }
+
+    CatalogEntry *entry = CatalogSlot(job->catalog, job->fingerprint);
+    ForgetCatalogEntry(entry);
+    entry->fingerprint = job->fingerprint;
+    entry->size = job->size;
+    entry->seed = job->seed;
+    entry->game = (uint64_t)game;
+    entry->numSteps = steps ? numSteps : 0;
+    entry->steps = steps;
+    return steps != NULL;
+}
+
+/**
+ * Whether a recorded move can be made on the board as it stands without breaking anything: the catalog could have come from anywhere.
+ * Treat output as boolean
+ */
+int StepFits(
+    _In_ const Board *board,
+    _In_ const CatalogStep *step)
+{
+    if (!IsFieldStack(step->dest) && step->dest != STACK_ORDERED)
+    {
+        return 0;
+    }
+    if (step->src == STACK_HAND)
+    {
+        return step->handIndex < board->numCards[STACK_HAND];
+    }
+    return IsFieldStack(step->src) && step->src != step->dest && step->count != 0 && step->count <= board->moveable[step->src];
+}
+
+/**
+ * Deals a catalogued game again, on a board with a foundation of its own, and makes its recorded moves without generating any.
+ * Without recorded moves the shuffle is played again instead, which is the same game, move for move.
+ */
+_Success_(return == 0) int ReplayGame(
+    _Inout_ Board *board,
+    _In_ const CatalogEntry *entry,
+    _In_reads_(size) const card_t data[],
+    const size_t size,
+    _In_ const SortJob *job)
+{
+    board->flags = job->flags;
+    board->searchBudget = job->searchBudget;
+    board->weights = &job->weights;
+    SeedRng(&board->rng, entry->seed, entry->game);
+    if (board->trace)
+    {
+        TraceEvent(board, SOLITAIRE_EVENT_DEAL, STACK_DECK, STACK_FIELD, (size_t)entry->game, 0);
+    }
+
+    int result;
+    if (entry->numSteps == 0)
+    {
+        result = TrySort(board, data, size, NULL, job->abort);
+    }
+    else
+    {
+        ResetBoard(board, data, size);
+        ShuffleAndDeal(board);
+
+        UndoRecord scratch;
+        size_t i = 0;
+        for (; i < entry->numSteps && !IsCancelled(job->abort); ++i)
+        {
+            const CatalogStep *step = &entry->steps[i];
+            if (step->src == STACK_DECK)
+            {
+                ApplyDraw(board, &scratch);
+                continue;
+            }
+            if (!StepFits(board, step))
+            {
+                break;
+            }
+            Move move;
+            move.count = step->src == STACK_HAND ? step->handIndex : (size_t)step->count;
+            move.score = 0;
+            move.src = step->src;
+            move.dest = step->dest;
+            ApplyMove(board, &move, &scratch);
+        }
+        result = i == entry->numSteps && board->numCards[STACK_ORDERED] == size && CheckOrdered(StackCards(board, STACK_ORDERED), size) ? 0 : 1;
+    }
+
+    if (board->trace)
+    {
+        TraceEvent(board, SOLITAIRE_EVENT_GAME_OVER, STACK_ORDERED, STACK_ORDERED, (size_t)result, 0);
+    }
+    return result;
+}
+
+SolitaireSortCatalog *SolitaireSortCreateCatalog(
+    const size_t capacity)
+{
+    SolitaireSortCatalog *catalog = (SolitaireSortCatalog *)malloc(sizeof(SolitaireSortCatalog));
+    if (!catalog)
+    {
+        return NULL;
+    }
+    catalog->capacity = capacity ? capacity : (size_t)CATALOG_DEFAULT_CAPACITY;
+    catalog->entries = (CatalogEntry *)calloc(catalog->capacity, sizeof(CatalogEntry));
+    if (!catalog->entries)
+    {
+        free(catalog);
+        return NULL;
+    }
+    return catalog;
+}
+
+void SolitaireSortDestroyCatalog(
+    _Inout_opt_ SolitaireSortCatalog *catalog)
+{
+    if (!catalog)
+    {
+        return;
+    }
+    for (size_t i = 0; i < catalog->capacity; ++i)
+    {
+        free(catalog->entries[i].steps);
+    }
+    free(catalog->entries);
+    free(catalog);
+}
+
+/**
+ * Leads every file written by SolitaireSortSaveCatalog. Each entry follows as its CatalogEntry, steps pointer and all, then its steps.
+ */
+typedef struct
+{
+    char magic[4];
+    /** sizeof(CatalogStep) where the file was written, as a check it is being read back the same way. */
+    uint32_t stepSize;
+    /** How many entries follow. */
+    uint64_t numEntries;
+
+} CatalogHeader;
+
+static const char CATALOG_MAGIC[4] = {'S', 'S', 'C', 'T'};
+
+_Success_(return == 0) int SolitaireSortSaveCatalog(
+    _In_ const SolitaireSortCatalog *catalog,
+    _Inout_ FILE *output)
+{
+    CatalogHeader header;
+    memcpy(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+    header.stepSize = sizeof(CatalogStep);
+    header.numEntries = 0;
+    for (size_t i = 0; i < catalog->capacity; ++i)
+    {
+        header.numEntries += catalog->entries[i].size != 0;
+    }
+    if (fwrite(&header, sizeof(header), 1, output) != 1)
+    {
+        return 1;
+    }
+
+    for (size_t i = 0; i < catalog->capacity; ++i)
+    {
+        const CatalogEntry *entry = &catalog->entries[i];
+        if (entry->size == 0)
+        {
+            continue;
+        }
+        // Seed-only entries have no steps, and no array to write them from.
+        if (fwrite(entry, sizeof(*entry), 1, output) != 1 ||
+            (entry->numSteps != 0 && fwrite(entry->steps, sizeof(CatalogStep), (size_t)entry->numSteps, output) != entry->numSteps))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+_Success_(return == 0) int SolitaireSortLoadCatalog(
+    _Inout_ SolitaireSortCatalog *catalog,
+    _Inout_ FILE *input)
+{
+    CatalogHeader header;
+    if (fread(&header, sizeof(header), 1, input) != 1 || memcmp(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) != 0 ||
+        header.stepSize != sizeof(CatalogStep))
+    {
+        return 1;
+    }
+
+    for (uint64_t i = 0; i < header.numEntries; ++i)
+    {
+        CatalogEntry read;
+        if (fread(&read, sizeof(read), 1, input) != 1 || read.size == 0 || read.game > (uint64_t)LONG_MAX ||
+            read.numSteps > SIZE_MAX / sizeof(CatalogStep))
+        {
+            return 1;
+        }
+        read.steps = NULL;
+        if (read.numSteps != 0)
+        {
+            read.steps = (CatalogStep *)malloc((size_t)read.numSteps * sizeof(CatalogStep));
+            if (!read.steps || fread(read.steps, sizeof(CatalogStep), (size_t)read.numSteps, input) != read.numSteps)
+            {
+                free(read.steps);
+                return 1;
+            }
+        }
+
+        CatalogEntry *entry = CatalogSlot(catalog, read.fingerprint);
+        ForgetCatalogEntry(entry);
+        *entry = read;
+    }
+    return 0;
+}
+
+/**
+ * Plays up to numThreads games at once, each worker on its own board, and copies the first win back into data.
+ * Games are handed out one at a time from job->nextGame, so a thread stuck in a long game never holds up the others.
+ */
+_Success_(return == 0) int SortInParallel(
+    _Inout_ SortJob *job,
+    _Inout_updates_all_(size) card_t data[],
+    const size_t size,
+    const size_t numThreads,
+    _In_opt_ const SolitaireSortOptions *options,
+    _Inout_ SolitaireSortStats *stats)
+{
+    const uint64_t callStart = NowNanos();
+    SortWorker *workers = (SortWorker *)malloc(numThreads * sizeof(SortWorker));
+    Board *boards = (Board *)malloc(numThreads * sizeof(Board));
+    Thread *threads = (Thread *)malloc(numThreads * sizeof(Thread));
+    int *started = (int *)calloc(numThreads, sizeof(int));
+    SolitaireSortThreadStats *threadStats = (SolitaireSortThreadStats *)calloc(numThreads, sizeof(SolitaireSortThreadStats));
+    if (!workers || !boards || !threads || !started || !threadStats)
+    {
+        free(workers);
+        free(boards);
+        free(threads);
+        free(started);
+        free(threadStats);
+        return 1;
+    }
+    stats->allocations += 5;
+
+    // Every worker keeps its own foundation: data has to stay readable until everyone is done dealing from it.
+    size_t numWorkers = 0;
+    for (; numWorkers < numThreads; ++numWorkers)
+    {
+        workers[numWorkers].job = job;
+        workers[numWorkers].board = &boards[numWorkers];
+        workers[numWorkers].won = 0;
+        workers[numWorkers].gamesPlayed = 0;
+        workers[numWorkers].busyNanos = 0;
+        if (ConstructBoard(&boards[numWorkers], size, NULL, NULL, 0) != 0)
+        {
+            break;
+        }
+        AttachTrace(&boards[numWorkers], ThreadTrace(options, numWorkers));
+    }
+
+    // Worker 0 runs on the calling thread.
+    for (size_t i = 1; i < numWorkers; ++i)
+    {
+        started[i] = ThreadStart(&threads[i], SortWorkerThread, &workers[i]) == 0;
+    }
+    if (numWorkers != 0)
+    {
+        RunSortWorker(&workers[0]);
+    }
+
+    // Everyone has to be joined before the win is copied over data, since the others may still be dealing from it.
+    for (size_t i = 1; i < numWorkers; ++i)
+    {
+        if (started[i])
+        {
+            ThreadJoin(&threads[i]);
+        }
+    }
+
+    int result = 1;
+    for (size_t i = 0; i < numWorkers; ++i)
+    {
+        if (workers[i].won)
+        {
+            memcpy(data, StackCards(&boards[i], STACK_ORDERED), size);
+            result = 0;
+            if (job->catalog)
+            {
+                stats->allocations += RecordWin(job, &boards[i], workers[i].game);
+            }
+        }
+        stats->gamesPlayed += workers[i].gamesPlayed;
+        threadStats[i].tasksRun = workers[i].gamesPlayed;
+        threadStats[i].busyNanos = workers[i].busyNanos;
+        threadStats[i].counters = boards[i].counters;
+        TallyBoard(&boards[i], stats);
+        DestructBoard(&boards[i]);
+    }
+    ReportThreadStats(options, numThreads, threadStats, callStart);
+
+    free(workers);
+    free(boards);
+    free(threads);
+    free(started);
+    free(threadStats);
+    return result;
+}
+
+/**
+ * Replays the catalogued game for data if there is one, and plays as usual otherwise, writing the win down.
+ * Either way games are dealt from data, never from the last game's leftovers, so each is down to its seed and game index alone.
+ */
+_Success_(return == 0) int SortFromCatalog(
+    _Inout_updates_all_(size) card_t data[],
+    const size_t size,
+    const size_t numThreads,
+    _In_ const SolitaireSortOptions *options,
+    _Inout_ SolitaireSortStats *stats)
+{
+    SortJob job;
+    ConstructSortJob(&job, data, size, options, ResolveSeed(options), 0);
+    job.catalog = options->catalog;
+    job.fingerprint = FingerprintDeck(data, size, &job);
+
+    CatalogEntry *entry = FindCatalogEntry(job.catalog, job.fingerprint, size);
+    Board board;
+    if (entry && ConstructBoard(&board, size, NULL, NULL, 0) == 0)
+    {
+        const uint64_t callStart = NowNanos();
+        AttachTrace(&board, ThreadTrace(options, 0));
+        const int result = ReplayGame(&board, entry, data, size, &job);
+        if (result == 0)
+        {
+            memcpy(data, StackCards(&board, STACK_ORDERED), size);
+        }
+        ++stats->gamesPlayed;
+        TallyBoard(&board, stats);
+
+        SolitaireSortThreadStats threadStats;
+        threadStats.tasksRun = 1;
+        threadStats.tasksStolen = 0;
+        threadStats.busyNanos = NowNanos() - callStart;
+        threadStats.counters = board.counters;
+        DestructBoard(&board);
+        if (result == 0)
+        {
+            stats->path = SOLITAIRE_PATH_REPLAYED;
+            ReportThreadStats(options, 1, &threadStats, callStart);
+            return 0;
+        }
+
+        // Recorded on another machine or by another version, say. It will be written down again once this input is won.
+        ForgetCatalogEntry(entry);
+    }
+    return SortInParallel(&job, data, size, numThreads, options, stats);
+}
+
+/**
+ * Merges sorted runs (a) and (b) into (out), which mustn't overlap either.
+ */
+void MergeCards(
+    _In_reads_(numA) const card_t a[],
+    const size_t numA,
+    _In_reads_(numB) const card_t b[],
+    const size_t numB,
+    _Out_writes_(numA + numB) card_t out[])
+{
+    size_t i = 0;
+    size_t j = 0;
+    size_t k = 0;
+    while (i < numA && j < numB)
+    {
+        out[k++] = b[j] < a[i] ? b[j++] : a[i++];
+    }
+    memcpy(out + k, a + i, numA - i);
+    memcpy(out + k + numA - i, b + j, numB - j);
+}
+
+/**
+ * Merges sorted runs of (width) cards pairwise, bottom up, bouncing between data and buffer until data is one run.
+ */
+void MergeChunks(
+    _Inout_updates_all_(size) card_t data[],
+    _Out_writes_(size) card_t buffer[],
+    const size_t size,
+    size_t width)
+{
+    card_t *from = data;
+    card_t *to = buffer;
+    for (; width < size; width *= 2)
+    {
+        for (size_t start = 0; start < size; start += 2 * width)
+        {
+            const size_t mid = size - start < width ? size : start + width;
+            const size_t end = size - mid < width ? size : mid + width;
+            MergeCards(from + start, mid - start, from + mid, end - mid, to + start);
+        }
+        card_t *temp = from;
+        from = to;
+        to = temp;
+    }
+    if (from != data)
+    {
+        memcpy(data, from, size);
+    }
+}
+
+/**
+ * What SortInChunks does instead of a batch when there is a catalog, which isn't locked: each chunk is looked up and sorted in turn,
+ * its games still spread over numThreads. Reports like a batch, through options->stats and options->threadStats, as one thread.
+ */
+_Success_(return == 0) int SortChunksFromCatalog(
+    _Inout_updates_(numChunks) card_t *decks[],
+    _In_reads_(numChunks) const size_t sizes[],
+    const size_t numChunks,
+    const size_t numThreads,
+    _In_ const SolitaireSortOptions *options)
+{
+    const uint64_t callStart = NowNanos();
+    SolitaireSortStats stats;
+    memset(&stats, 0, sizeof(stats));
+    SolitaireSortOptions deckOptions = *options;
+    deckOptions.threadStats = NULL;
+
+    int result = 0;
+    for (size_t i = 0; i < numChunks && result == 0; ++i)
+    {
+        if (TakeFastPath(decks[i], sizes[i], options) == SOLITAIRE_PATH_GAME)
+        {
+            result = SortFromCatalog(decks[i], sizes[i], numThreads, &deckOptions, &stats);
+        }
+    }
+
+    SolitaireSortThreadStats threadStats;
+    threadStats.tasksRun = numChunks;
+    threadStats.tasksStolen = 0;
+    threadStats.busyNanos = NowNanos() - callStart;
+    threadStats.counters = stats.counters;
+    ReportThreadStats(options, 1, &threadStats, callStart);
+    if (options->stats)
+    {
+        *options->stats = stats;
+    }
+    return result;
+}
+
+/**
+ * Chunk-and-merge, for decks too big to play well as one game.
+ * The chunks are sorted in place as one batch, spread over as many threads as the options ask for, so already sorted chunks skip their game
+ * like any other deck. Then they are merged through one buffer the size of data. If a chunk loses, nothing is merged.
+ */
+_Success_(return == 0) int SortInChunks(
+    _Inout_updates_all_(size) card_t data[],
+    const size_t size,
+    const size_t numThreads,
+    _In_opt_ const SolitaireSortOptions *options,
+    _Inout_ SolitaireSortStats *stats)
+{
+    const size_t chunkSize = ResolveChunkSize(options);
+    const size_t numChunks = size / chunkSize + (size % chunkSize != 0);
+    card_t **decks = (card_t **)malloc(numChunks * sizeof(card_t *));
+    size_t *sizes = (size_t *)malloc(numChunks * sizeof(size_t));
+    int *statuses = (int *)malloc(numChunks * sizeof(int));
+    card_t *buffer = (card_t *)malloc(size);
+    int result = !decks || !sizes || !statuses || !buffer;
+    if (result == 0)
+    {
+        stats->allocations += 4;
+        for (size_t i = 0; i < numChunks; ++i)
+        {
+            decks[i] = data + i * chunkSize;
+            sizes[i] = size - i * chunkSize < chunkSize ? size - i * chunkSize : chunkSize;
+        }
+
+        SolitaireSortStats chunkStats;
+        SolitaireSortOptions chunkOptions;
+        if (options)
+        {
+            chunkOptions = *options;
+        }
+        else
+        {
+            memset(&chunkOptions, 0, sizeof(chunkOptions));
+        }
+        chunkOptions.stats = &chunkStats;
+        result = chunkOptions.catalog ? SortChunksFromCatalog(decks, sizes, numChunks, numThreads, &chunkOptions)
+                                      : SolitaireSortBatch(decks, sizes, numChunks, &chunkOptions, statuses);
+        stats->gamesPlayed += chunkStats.gamesPlayed;
+        stats->movesPlayed += chunkStats.movesPlayed;
+        stats->allocations += chunkStats.allocations;
+        AddCounters(&stats->counters, &chunkStats.counters);
+
+        if (result == 0)
+        {
+            MergeChunks(data, buffer, size, chunkSize);
+        }
+    }
+    else
+    {
+        ReportThreadStats(options, 0, NULL, NowNanos());
+    }
+    free(decks);
+    free(sizes);
+    free(statuses);
+    free(buffer);
+    return result;
+}
+
+_Success_(return == 0) int SolitaireSortWithOptions(
+    _Inout_updates_all_(size) card_t data[],
+    const size_t size,
+    _In_opt_ const SolitaireSortOptions *options)
+{
+    const long maxRetries = ResolveMaxRetries(options);
+    size_t numThreads = (options && options->numThreads) ? options->numThreads : 1;
+    if (numThreads > (size_t)maxRetries)
+    {
+        numThreads = (size_t)maxRetries;
+    }
+
+    SolitaireSortStats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.path = TakeFastPath(data, size, options);
+
+    const uint64_t callStart = NowNanos();
+    int result = 0;
+    if (stats.path == SOLITAIRE_PATH_GAME && size > ResolveMergeThreshold(options))
+    {
+        stats.path = SOLITAIRE_PATH_CHUNKED;
+        result = SortInChunks(data, size, numThreads, options, &stats);
+    }
+    else if (stats.path == SOLITAIRE_PATH_GAME && options && options->catalog)
+    {
+        result = SortFromCatalog(data, size, numThreads, options, &stats);
+    }
+    else if (stats.path == SOLITAIRE_PATH_GAME)
+    {
+        SortJob job;
+        ConstructSortJob(&job, data, size, options, ResolveSeed(options), numThreads == 1);
+
+        PackedDeck packed;
+        if (job.inPlace && WantsPacked(options) && PackDeck(&packed, data, size))
+        {
+            const uint64_t start = NowNanos();
+            result = SortPacked(&packed, &job, data, &stats);
+
+            SolitaireSortThreadStats threadStats;
+            threadStats.tasksRun = stats.gamesPlayed;
+            threadStats.tasksStolen = 0;
+            threadStats.busyNanos = NowNanos() - start;
+            threadStats.counters = stats.counters;
+            ReportThreadStats(options, 1, &threadStats, callStart);
+        }
+        else if (job.inPlace)
+        {
+            // Allocates nothing but the board, and not even that when the caller lends enough scratch.
+            Board board;
+            card_t *scratch = options ? options->scratch : NULL;
+            const size_t scratchSize = options ? options->scratchSize : 0;
+            result = ConstructBoard(&board, size, data, scratch, scratchSize);
+            if (result == 0)
+            {
+                AttachTrace(&board, ThreadTrace(options, 0));
+                const uint64_t start = NowNanos();
+                result = SortInPlace(&board, &job, data, size, &stats.gamesPlayed);
+                TallyBoard(&board, &stats);
+                DestructBoard(&board);
+
+                SolitaireSortThreadStats threadStats;
+                threadStats.tasksRun = stats.gamesPlayed;
+                threadStats.tasksStolen = 0;
+                threadStats.busyNanos = NowNanos() - start;
+                threadStats.counters = stats.counters;
+                ReportThreadStats(options, 1, &threadStats, callStart);
+            }
+        }
+        else
+        {
+            result = SortInParallel(&job, data, size, numThreads, options, &stats);
+        }
+    }
+    else
+    {
+        ReportThreadStats(options, 0, NULL, callStart);
+    }
+
+    if (options && options->stats)
+    {
+        *options->stats = stats;
+    }
+    return result;
+}
+
+/**
+ * Swaps whole records end for end, for keys that came in strictly descending.
+ */
+void ReverseRecords(
+    _Inout_updates_bytes_all_(count * recordSize) unsigned char records[],
+    const size_t count,
+    const size_t recordSize)
+{
+    for (size_t i = 0, j = count; i + 1 < j; ++i)
+    {
+        --j;
+        unsigned char *a = records + i * recordSize;
+        unsigned char *b = records + j * recordSize;
+        for (size_t k = 0; k < recordSize; ++k)
+        {
+            const unsigned char temp = a[k];
+            a[k] = b[k];
+            b[k] = temp;
+        }
+    }
+}
+
+/**
+ * Puts the records in the order of (tags), the record index of each card in the won foundation.
+ * Gathering into a copy touches each record once, where following the permutation's cycles in place would jump all over both.
+ */
+_Success_(return == 0) int GatherRecords(
+    _Inout_updates_bytes_all_(count * recordSize) unsigned char records[],
+    const size_t count,
+    const size_t recordSize,
+    _In_reads_(count) const uint32_t tags[],
+    _Inout_ SolitaireSortStats *stats)
+{
+    const size_t bytes = count * recordSize;
+    unsigned char *gathered = (unsigned char *)malloc(bytes ? bytes : 1);
+    if (!gathered)
+    {
+        return 1;
+    }
+    ++stats->allocations;
+    for (size_t i = 0; i < count; ++i)
+    {
+        memcpy(gathered + i * recordSize, records + (size_t)tags[i] * recordSize, recordSize);
+    }
+    memcpy(records, gathered, bytes);
+    free(gathered);
+    return 0;
+}
+
+_Success_(return == 0) int SolitaireSortRecords(
+    _Inout_updates_bytes_all_(count * recordSize) void *records,
+    const size_t count,
+    const size_t recordSize,
+    _In_ SolitaireSortKey key,
+    _In_opt_ void *context,
+    _In_opt_ const SolitaireSortOptions *options)
+{
+    if (count > UINT32_MAX || (recordSize && count > SIZE_MAX / recordSize))
+    {
+        return 1;
+    }
+
+    SolitaireSortStats stats;
+    memset(&stats, 0, sizeof(stats));
+    const uint64_t callStart = NowNanos();
+
+    card_t *keys = (card_t *)malloc(count ? count : 1);
+    if (!keys)
+    {
+        return 1;
+    }
+    ++stats.allocations;
+    unsigned char *bytes = (unsigned char *)records;
+    for (size_t i = 0; i < count; ++i)
+    {
+        keys[i] = key(bytes + i * recordSize, context);
+    }
+
+    int result = 0;
+    switch (ClassifyOrder(keys, count))
+    {
+    case ORDER_ASCENDING:
+        stats.path = SOLITAIRE_PATH_ALREADY_SORTED;
+        break;
+
+    case ORDER_DESCENDING:
+        ReverseRecords(bytes, count, recordSize);
+        stats.path = SOLITAIRE_PATH_REVERSED;
+        break;
+
+    default:
+        stats.path = SOLITAIRE_PATH_GAME;
+        break;
+    }
+
+    uint32_t *later = NULL;
+    if (stats.path == SOLITAIRE_PATH_GAME && options && (options->flags & SOLITAIRE_SORT_STABLE))
+    {
+        later = (uint32_t *)malloc(count * sizeof(uint32_t));
+        result = later == NULL;
+        if (later)
+        {
+            ++stats.allocations;
+            uint32_t seen[NUM_RANKS] = {0};
+            for (size_t i = count; i > 0; --i)
+            {
+                later[i - 1] = seen[CardRank(keys[i - 1])]++;
+            }
+        }
+    }
+
+    if (stats.path == SOLITAIRE_PATH_GAME && result == 0)
+    {
+        // The board keeps its own foundation, since tags can only follow cards around the arena.
+        Board board;
+        result = ConstructBoard(&board, count, NULL, NULL, 0) != 0 || AttachTags(&board) != 0;
+        board.later = later;
+        if (result == 0)
+        {
+            AttachTrace(&board, ThreadTrace(options, 0));
+            SortJob job;
+            ConstructSortJob(&job, keys, count, options, ResolveSeed(options), 0);
+
+            SortWorker worker;
+            worker.job = &job;
+            worker.board = &board;
+            worker.won = 0;
+            worker.gamesPlayed = 0;
+            worker.busyNanos = 0;
+            RunSortWorker(&worker);
+            stats.gamesPlayed = worker.gamesPlayed;
+
+            result = worker.won ? GatherRecords(bytes, count, recordSize, StackTags(&board, STACK_ORDERED), &stats) : 1;
+
+            SolitaireSortThreadStats threadStats;
+            threadStats.tasksRun = worker.gamesPlayed;
+            threadStats.tasksStolen = 0;
+            threadStats.busyNanos = worker.busyNanos;
+            threadStats.counters = board.counters;
+            ReportThreadStats(options, 1, &threadStats, callStart);
+        }
+        TallyBoard(&board, &stats);
+        DestructBoard(&board);
+    }
+    else
+    {
+        ReportThreadStats(options, 0, NULL, callStart);
+    }
+    free(later);
+    free(keys);
+
+    if (options && options->stats)
+    {
+        *options->stats = stats;
+    }
+    return result;
+}
+
+/**
+ * A run of deck indices [head, tail) belonging to one batch thread. The owner takes from the head, thieves from the tail.
+ * Each deck is a whole game or more, so a spin lock around two indices costs nothing next to the work it hands out.
+ */
+typedef struct
+{
+    AtomicInt lock;
+    size_t head;
+    size_t tail;
+
+} TaskDeque;
+
+void LockDeque(
+    _Inout_ TaskDeque *deque)
+{
+    while (!AtomicCompareExchange(&deque->lock, 0, 1))
+    {
+    }
+}
+
+void UnlockDeque(
+    _Inout_ TaskDeque *deque)
+{
+    AtomicStore(&deque->lock, 0);
+}
+
+/**
+ * Treat output as boolean. Takes the owner's next deck.
+ */
+int PopTask(
+    _Inout_ TaskDeque *deque,
+    _Out_ size_t *task)
+{
+    LockDeque(deque);
+    const int found = deque->head < deque->tail;
+    if (found)
+    {
+        *task = deque->head++;
+    }
+    UnlockDeque(deque);
+    return found;
+}
+
+/**
+ * Moves the back half of (victim)'s decks into (thief), which has run dry. Rounds up, so a last deck can be stolen too.
+ * @return How many decks were taken.
+ */
+size_t StealTasks(
+    _Inout_ TaskDeque *thief,
+    _Inout_ TaskDeque *victim)
+{
+    LockDeque(victim);
+    const size_t count = (victim->tail - victim->head + 1) / 2;
+    victim->tail -= count;
+    const size_t first = victim->tail;
+    UnlockDeque(victim);
+
+    if (count != 0)
+    {
+        LockDeque(thief);
+        thief->head = first;
+        thief->tail = first + count;
+        UnlockDeque(thief);
+    }
+    return count;
+}
+
+/**
+ * One thread of a SolitaireSortBatch call. Starts with a contiguous slice of the decks and steals from the others once it runs out.
+ */
+typedef struct
+{
+    card_t **decks;
+    const size_t *sizes;
+    int *statuses;
+    /** One per thread, indexed like the workers. */
+    TaskDeque *deques;
+    size_t numWorkers;
+    size_t self;
+    /** The slice [sliceHead, sliceTail) this thread starts with. Its deque can be stolen from as soon as any thread runs, so the board is sized from these. */
+    size_t sliceHead;
+    size_t sliceTail;
+    const SolitaireSortOptions *options;
+    uint64_t seed;
+    /** Only the counters are used. */
+    SolitaireSortStats stats;
+    /** This thread's entry in a per-call array, so they can be reported in one go. */
+    SolitaireSortThreadStats *threadStats;
+
+} BatchWorker;
+
+/**
+ * Treat output as boolean. Finds this thread's next deck, stealing if its own deque is empty.
+ * Decks are only ever moved between deques, never created, so once every deque looks empty there is nothing left to find.
+ */
+int NextBatchDeck(
+    _Inout_ BatchWorker *worker,
+    _Out_ size_t *deck)
+{
+    TaskDeque *own = &worker->deques[worker->self];
+    for (;;)
+    {
+        if (PopTask(own, deck))
+        {
+            return 1;
+        }
+
+        size_t stolen = 0;
+        for (size_t i = 1; i < worker->numWorkers && !stolen; ++i)
+        {
+            stolen = StealTasks(own, &worker->deques[(worker->self + i) % worker->numWorkers]);
+        }
+        if (!stolen)
+        {
+            return 0;
+        }
+        worker->threadStats->tasksStolen += stolen;
+    }
+}
+
+/**
+ * Builds one board big enough for the largest deck in its starting slice, then reuses its arena for every deck in turn.
+ * Each deck is its own in-place sort, so the board's foundation is simply pointed at the next deck.
+ * A stolen deck bigger than anything seen so far rebuilds the board to fit.
+ */
+void RunBatchWorker(
+    _Inout_ BatchWorker *worker)
+{
+    size_t boardSize = 0;
+    for (size_t i = worker->sliceHead; i < worker->sliceTail; ++i)
+    {
+        boardSize = worker->sizes[i] > boardSize ? worker->sizes[i] : boardSize;
+    }
+
+    Board board;
+    int haveBoard = 0;
+    size_t i;
+    while (NextBatchDeck(worker, &i))
+    {
+        const uint64_t start = NowNanos();
+        ++worker->threadStats->tasksRun;
+        card_t *deck = worker->decks[i];
+        const size_t size = worker->sizes[i];
+        if (worker->options && worker->options->cancel && IsCancelled(&worker->options->cancel->raised))
+        {
+            worker->statuses[i] = 1; // Called off before this deck's turn came up
+            continue;
+        }
+        if (TakeFastPath(deck, size, worker->options) != SOLITAIRE_PATH_GAME)
+        {
+            worker->statuses[i] = 0;
+            worker->threadStats->busyNanos += NowNanos() - start;
+            continue;
+        }
+
+        // Every deck gets its own stream of shuffles, so a batch is reproducible however it is split up.
+        uint64_t x = worker->seed + i;
+        SortJob job;
+        ConstructSortJob(&job, deck, size, worker->options, SplitMix64(&x), 1);
+
+        PackedDeck packed;
+        if (WantsPacked(worker->options) && PackDeck(&packed, deck, size))
+        {
+            worker->statuses[i] = SortPacked(&packed, &job, deck, &worker->stats);
+            worker->threadStats->busyNanos += NowNanos() - start;
+            continue;
+        }
+
+        if (!haveBoard || size > boardSize)
+        {
+            if (haveBoard)
+            {
+                TallyBoard(&board, &worker->stats);
+                DestructBoard(&board);
+            }
+            boardSize = size > boardSize ? size : boardSize;
+            haveBoard = ConstructBoard(&board, boardSize, deck, NULL, 0) == 0;
+            if (haveBoard)
+            {
+                AttachTrace(&board, ThreadTrace(worker->options, worker->self));
+            }
+        }
+
+        if (haveBoard)
+        {
+            worker->statuses[i] = SortInPlace(&board, &job, deck, size, &worker->stats.gamesPlayed);
+        }
+        else
+        {
+            worker->statuses[i] = 1;
+        }
+        worker->threadStats->busyNanos += NowNanos() - start;
+    }
+
+    if (haveBoard)
+    {
+        TallyBoard(&board, &worker->stats);
+        DestructBoard(&board);
+    }
+}
+
+THREAD_PROC(BatchWorkerThread)
+{
+    RunBatchWorker((BatchWorker *)arg);
+    THREAD_RETURN;
+}
+
+_Success_(return == 0) int SolitaireSortBatch(
+    _Inout_updates_all_(count) card_t *decks[],
+    _In_reads_(count) const size_t sizes[],
+    const size_t count,
+    _In_opt_ const SolitaireSortOptions *options,
+    _Out_writes_all_(count) int statuses[])
+{
+    const uint64_t callStart = NowNanos();
+    size_t numThreads = (options && options->numThreads) ? options->numThreads : 1;
+    if (numThreads > count)
+    {
+        numThreads = count ? count : 1;
+    }
+
+    BatchWorker *workers = (BatchWorker *)malloc(numThreads * sizeof(BatchWorker));
+    TaskDeque *deques = (TaskDeque *)malloc(numThreads * sizeof(TaskDeque));
+    Thread *threads = (Thread *)malloc(numThreads * sizeof(Thread));
+    int *started = (int *)calloc(numThreads, sizeof(int));
+    SolitaireSortThreadStats *threadStats = (SolitaireSortThreadStats *)calloc(numThreads, sizeof(SolitaireSortThreadStats));
+    if (!workers || !deques || !threads || !started || !threadStats)
+    {
+        free(workers);
+        free(deques);
+        free(threads);
+        free(started);
+        free(threadStats);
+        for (size_t i = 0; i < count; ++i)
+        {
+            statuses[i] = 1;
+        }
+        return 1;
+    }
+
+    const uint64_t seed = ResolveSeed(options);
+    for (size_t t = 0; t < numThreads; ++t)
+    {
+        deques[t].lock = 0;
+        deques[t].head = count * t / numThreads;
+        deques[t].tail = count * (t + 1) / numThreads;
+
+        workers[t].decks = decks;
+        workers[t].sizes = sizes;
+        workers[t].statuses = statuses;
+        workers[t].deques = deques;
+        workers[t].numWorkers = numThreads;
+        workers[t].self = t;
+        workers[t].sliceHead = deques[t].head;
+        workers[t].sliceTail = deques[t].tail;
+        workers[t].options = options;
+        workers[t].seed = seed;
+        memset(&workers[t].stats, 0, sizeof(SolitaireSortStats));
+        workers[t].threadStats = &threadStats[t];
+    }
+
+    // Worker 0 runs on the calling thread. The slice of a thread that won't start just gets stolen by the others.
+    for (size_t t = 1; t < numThreads; ++t)
+    {
+        started[t] = ThreadStart(&threads[t], BatchWorkerThread, &workers[t]) == 0;
+    }
+    RunBatchWorker(&workers[0]);
+
+    SolitaireSortStats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.path = SOLITAIRE_PATH_GAME;
+    stats.allocations = 5;
+    for (size_t t = 0; t < numThreads; ++t)
+    {
+        if (t != 0 && started[t])
+        {
+            ThreadJoin(&threads[t]);
+        }
+        stats.gamesPlayed += workers[t].stats.gamesPlayed;
+        stats.movesPlayed += workers[t].stats.movesPlayed;
+        stats.allocations += workers[t].stats.allocations;
+        AddCounters(&stats.counters, &workers[t].stats.counters);
+        threadStats[t].counters = workers[t].stats.counters;
+    }
+    if (options && options->stats)
+    {
+        *options->stats = stats;
+    }
+    ReportThreadStats(options, numThreads, threadStats, callStart);
+
+    int result = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        result |= statuses[i];
+    }
+
+    free(workers);
+    free(deques);
+    free(threads);
+    free(started);
+    free(threadStats);
+    return result;
+}
+
+enum
+{
+    STREAM_DEFAULT_BUDGET = 64 << 20, // Bytes
+};
+
+/**
+ * One sorted run waiting in the spill file, read back a buffer at a time during the merge.
+ */
+typedef struct
+{
+    /** Where the next unread byte of the run is. */
+    fpos_t pos;
+    /** Bytes of the run not yet read into the buffer. */
+    size_t unread;
+    card_t *buffer;
+    size_t length;
+    size_t next;
+
+} StreamRun;
+
+/**
+ * Treat output as boolean. Makes sure the run has a card ready, reading more of it if the buffer is used up.
+ */
+int RefillRun(
+    _Inout_ StreamRun *run,
+    _Inout_ FILE *spill,
+    const size_t bufferSize)
+{
+    if (run->next != run->length)
+    {
+        return 1;
+    }
+    if (run->unread == 0 || fsetpos(spill, &run->pos) != 0)
+    {
+        return 0;
+    }
+    const size_t want = run->unread < bufferSize ? run->unread : bufferSize;
+    run->length = fread(run->buffer, 1, want, spill);
+    run->next = 0;
+    run->unread -= run->length;
+    return run->length == want && fgetpos(spill, &run->pos) == 0;
+}
+
+/**
+ * Restores the min-heap of run indices, keyed by each run's next card, downward from (at).
+ */
+void SiftDownRuns(
+    _Inout_updates_(count) size_t heap[],
+    const size_t count,
+    size_t at,
+    _In_ const StreamRun runs[])
+{
+    for (;;)
+    {
+        size_t smallest = at;
+        for (size_t child = 2 * at + 1; child < 2 * at + 3 && child < count; ++child)
+        {
+            const StreamRun *a = &runs[heap[child]];
+            const StreamRun *b = &runs[heap[smallest]];
+            if (a->buffer[a->next] < b->buffer[b->next])
+            {
+                smallest = child;
+            }
+        }
+        if (smallest == at)
+        {
+            return;
+        }
+        const size_t temp = heap[at];
+        heap[at] = heap[smallest];
+        heap[smallest] = temp;
+        at = smallest;
+    }
+}
+
+/**
+ * k-way merges the sorted runs in (spill) into (output), splitting (memory) evenly between the runs and the output buffer.
+ */
+_Success_(return == 0) int MergeRuns(
+    _Inout_ FILE *spill,
+    _Inout_updates_(numRuns) StreamRun runs[],
+    const size_t numRuns,
+    _Inout_updates_(memorySize) card_t memory[],
+    const size_t memorySize,
+    _Inout_ FILE *output)
+{
+    const size_t bufferSize = memorySize / (numRuns + 1);
+    size_t *heap = (size_t *)malloc(numRuns * sizeof(size_t));
+    if (bufferSize == 0 || !heap)
+    {
+        free(heap);
+        return 1;
+    }
+
+    size_t count = 0;
+    int result = 0;
+    for (size_t i = 0; i < numRuns; ++i)
+    {
+        runs[i].buffer = memory + i * bufferSize;
+        runs[i].length = 0;
+        runs[i].next = 0;
+        if (RefillRun(&runs[i], spill, bufferSize))
+        {
+            heap[count++] = i;
+        }
+        else
+        {
+            result |= runs[i].unread != 0;
+        }
+    }
+    for (size_t i = count / 2; i > 0; --i)
+    {
+        SiftDownRuns(heap, count, i - 1, runs);
+    }
+
+    card_t *out = memory + numRuns * bufferSize;
+    size_t numOut = 0;
+    while (count != 0 && result == 0)
+    {
+        StreamRun *run = &runs[heap[0]];
+        out[numOut++] = run->buffer[run->next++];
+        if (numOut == bufferSize)
+        {
+            result = fwrite(out, 1, numOut, output) == numOut ? 0 : 1;
+            numOut = 0;
+        }
+
+        if (!RefillRun(run, spill, bufferSize))
+        {
+            result |= run->unread != 0;
+            heap[0] = heap[--count];
+        }
+        SiftDownRuns(heap, count, 0, runs);
+    }
+    if (result == 0 && fwrite(out, 1, numOut, output) != numOut)
+    {
+        result = 1;
+    }
+
+    free(heap);
+    return result;
+}
+
+_Success_(return == 0) int SolitaireSortStream(
+    _Inout_ FILE *input,
+    _Inout_ FILE *output,
+    _In_opt_ const SolitaireSortStreamOptions *options)
+{
+    const size_t budget = (options && options->memoryBudget) ? options->memoryBudget : (size_t)STREAM_DEFAULT_BUDGET;
+    // Each chunk is played in place, with the rest of the budget lent to it as the board.
+    const size_t chunkSize = budget > NUM_CARDS_IN_HAND ? (budget - NUM_CARDS_IN_HAND) / (NUM_FIELD_STACKS + 2) : 0;
+    card_t *memory = chunkSize ? (card_t *)malloc(budget) : NULL;
+    if (!memory)
+    {
+        return 1;
+    }
+
+    SolitaireSortOptions sortOptions;
+    memset(&sortOptions, 0, sizeof(sortOptions));
+    if (options && options->sort)
+    {
+        sortOptions = *options->sort;
+    }
+    sortOptions.numThreads = 1;
+    // Chunking would allocate a merge buffer and boards of its own, outside the budget, so every chunk is one game on the lent scratch.
+    sortOptions.mergeThreshold = SIZE_MAX;
+    // So would the catalog, which also keeps every chunk's moves, and the search's undo log grows as it goes.
+    sortOptions.catalog = NULL;
+    sortOptions.searchBudget = 0;
+    sortOptions.scratch = memory + chunkSize;
+    sortOptions.scratchSize = budget - chunkSize;
+    sortOptions.stats = NULL;
+    sortOptions.threadStats = NULL;
+
+    FILE *spill = NULL;
+    StreamRun *runs = NULL;
+    size_t numRuns = 0;
+    size_t runsCapacity = 0;
+    int result = 0;
+
+    size_t length;
+    while (result == 0 && (length = fread(memory, 1, chunkSize, input)) != 0)
+    {
+        result = SolitaireSortWithOptions(memory, length, &sortOptions);
+        if (result != 0)
+        {
+            break;
+        }
+
+        // Input that fits in one chunk never touches the disk.
+        if (numRuns == 0 && length < chunkSize)
+        {
+            result = fwrite(memory, 1, length, output) == length ? 0 : 1;
+            break;
+        }
+
+        if (numRuns == runsCapacity)
+        {
+            runsCapacity = runsCapacity ? runsCapacity * 2 : 16;
+            StreamRun *grown = (StreamRun *)realloc(runs, runsCapacity * sizeof(StreamRun));
+            if (!grown)
+            {
+                result = 1;
+                break;
+            }
+            runs = grown;
+        }
+        if (!spill && !(spill = tmpfile()))
+        {
+            result = 1;
+            break;
+        }
+
+        StreamRun *run = &runs[numRuns++];
+        run->unread = length;
+        if (fseek(spill, 0, SEEK_END) != 0 || fgetpos(spill, &run->pos) != 0 || fwrite(memory, 1, length, spill) != length)
+        {
+            result = 1;
+        }
+    }
+
+    if (result == 0 && ferror(input))
+    {
+        result = 1;
+    }
+    if (result == 0 && numRuns != 0)
+    {
+        result = MergeRuns(spill, runs, numRuns, memory, budget, output);
+    }
+
+    if (spill)
+    {
+        fclose(spill);
+    }
+    free(runs);
+    free(memory);
+    return result;
+}
+
+/**
+ * Leads every dump written by SolitaireSortWriteTrace.
+ */
+typedef struct
+{
+    char magic[4];
+    /** sizeof(SolitaireSortEvent) where the dump was written, as a check it is being read back the same way. */
+    uint32_t eventSize;
+    /** SolitaireSortTrace.written at the time. */
+    uint64_t written;
+    /** How many events follow, the newest of the ones written. */
+    uint64_t numEvents;
+
+} TraceHeader;
+
+static const char TRACE_MAGIC[4] = {'S', 'S', 'E', 'V'};
+
+_Success_(return == 0) int SolitaireSortWriteTrace(
+    _In_ const SolitaireSortTrace *trace,
+    _Inout_ FILE *output)
+{
+    const int usable = trace->events && trace->capacity != 0 && (trace->capacity & (trace->capacity - 1)) == 0;
+    const size_t capacity = usable ? trace->capacity : 0;
+
+    TraceHeader header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header.eventSize = sizeof(SolitaireSortEvent);
+    header.written = trace->written;
+    header.numEvents = trace->written < capacity ? trace->written : capacity;
+    if (fwrite(&header, sizeof(header), 1, output) != 1)
+    {
+        return 1;
+    }
+
+    // Oldest first, which is from where the next event would go round to the end, then the start up to there.
+    const size_t oldest = (size_t)((trace->written - header.numEvents) & (capacity ? capacity - 1 : 0));
+    const size_t numEvents = (size_t)header.numEvents;
+    const size_t firstPart = capacity - oldest < numEvents ? capacity - oldest : numEvents;
+    if (fwrite(trace->events + oldest, sizeof(SolitaireSortEvent), firstPart, output) != firstPart ||
+        fwrite(trace->events, sizeof(SolitaireSortEvent), numEvents - firstPart, output) != numEvents - firstPart)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Names a stack the way the decoded trace reads.
+ */
+void PrintStack(
+    _Inout_ FILE *output,
+    const size_t stack)
+{
+    if (stack == STACK_DECK)
+    {
+        fputs("deck", output);
+    }
+    else if (stack == STACK_HAND)
+    {
+        fputs("hand", output);
+    }
+    else if (IsFieldStack(stack))
+    {
+        fprintf(output, "field %lu", (unsigned long)(stack - STACK_FIELD));
+    }
+    else
+    {
+        fputs("foundation", output);
+    }
+}
+
+/**
+ * Cards are bytes, so anything unprintable is shown in hex.
+ */
+void PrintCard(
+    _Inout_ FILE *output,
+    const card_t card)
+{
+    const unsigned char byte = (unsigned char)card;
+    if (byte >= 0x20 && byte < 0x7F)
+    {
+        fprintf(output, "'%c'", (char)byte);
+    }
+    else
+    {
+        fprintf(output, "0x%02X", (unsigned)byte);
+    }
+}
+
+void PrintEvent(
+    _Inout_ FILE *output,
+    const uint64_t index,
+    _In_ const SolitaireSortEvent *event)
+{
+    fprintf(output, "%llu: ", (unsigned long long)index);
+    switch (event->kind)
+    {
+    case SOLITAIRE_EVENT_DEAL:
+        fprintf(output, "deal game %lu", (unsigned long)event->count);
+        break;
+
+    case SOLITAIRE_EVENT_MOVE:
+        fprintf(output, "move %lu from ", (unsigned long)event->count);
+        PrintStack(output, event->src);
+        fputs(" to ", output);
+        PrintStack(output, event->dest);
+        fputs(", bottom card ", output);
+        PrintCard(output, event->card);
+        break;
+
+    case SOLITAIRE_EVENT_DRAW:
+        fprintf(output, "draw %lu", (unsigned long)event->count);
+        if (event->count != 0)
+        {
+            fputs(", top card ", output);
+            PrintCard(output, event->card);
+        }
+        break;
+
+    case SOLITAIRE_EVENT_SWEEP:
+        fprintf(output, "sweep %lu to the foundation, ending on ", (unsigned long)event->count);
+        PrintCard(output, event->card);
+        break;
+
+    case SOLITAIRE_EVENT_UNDO:
+        if (event->src == STACK_DECK)
+        {
+            fprintf(output, "undo draw of %lu", (unsigned long)event->count);
+        }
+        else
+        {
+            fprintf(output, "undo move of %lu from ", (unsigned long)event->count);
+            PrintStack(output, event->src);
+            fputs(" to ", output);
+            PrintStack(output, event->dest);
+        }
+        break;
+
+    case SOLITAIRE_EVENT_GAME_OVER:
+        fputs(event->count == 0 ? "won" : "lost", output);
+        break;
+
+    default:
+        fprintf(output, "unknown event %u", (unsigned)event->kind);
+        break;
+    }
+    fputc('\n', output);
+}
+
+_Success_(return == 0) int SolitaireSortPrintTrace(
+    _Inout_ FILE *input,
+    _Inout_ FILE *output)
+{
+    TraceHeader header;
+    size_t numRead;
+    while ((numRead = fread(&header, 1, sizeof(header), input)) == sizeof(header))
+    {
+        if (memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 || header.eventSize != sizeof(SolitaireSortEvent))
+        {
+            return 1;
+        }
+        fprintf(output, "trace: %llu events recorded, last %llu kept\n", (unsigned long long)header.written, (unsigned long long)header.numEvents);
+
+        const uint64_t first = header.written - header.numEvents;
+        for (uint64_t i = 0; i < header.numEvents; ++i)
+        {
+            SolitaireSortEvent event;
+            if (fread(&event, sizeof(event), 1, input) != 1)
+            {
+                return 1;
+            }
+            PrintEvent(output, first + i, &event);
+        }
+    }
+    return (numRead != 0 || ferror(input) || ferror(output)) ? 1 : 0;
+}
+
+/**
+ * A sort queued for the submit pool, then run by one of its threads, from SolitaireSortSubmit until SolitaireSortWait.
+ */
+struct SolitaireSortTask
+{
+    card_t *data;
+    size_t size;
+    /** A copy, so the caller's own can go out of scope. Zeroed if there were none, which means the same thing. */
+    SolitaireSortOptions options;
+    SolitaireSortCallback done;
+    void *context;
+    int status;
+    /** Set under the pool's lock once the callback has returned. */
+    int finished;
+    /** The next task in the queue. */
+    SolitaireSortTask *next;
+};
+
+// Constants
+enum
+{
+    SUBMIT_POOL_THREADS = 8,
+};
+
+/**
+ * The threads SolitaireSortSubmit queues its tasks for. A new one is started whenever more tasks are waiting than threads are idle,
+ * up to SUBMIT_POOL_THREADS, and from then on it lives as long as the process, sleeping until the next task comes.
+ */
+typedef struct
+{
+    Mutex lock;
+    /** Signalled whenever a task is queued. */
+    Condition queued;
+    /** Broadcast whenever a task is finished. */
+    Condition finished;
+    /** Oldest first. */
+    SolitaireSortTask *head;
+    SolitaireSortTask *tail;
+    size_t numQueued;
+    size_t numThreads;
+    size_t numIdle;
+
+} SubmitPool;
+
+static SubmitPool submitPool = {MUTEX_INIT, CONDITION_INIT, CONDITION_INIT, NULL, NULL, 0, 0, 0};
+
+THREAD_PROC(SubmitPoolThread)
+{
+    (void)arg;
+    MutexLock(&submitPool.lock);
+    for (;;)
+    {
+        ++submitPool.numIdle;
+        while (!submitPool.head)
+        {
+            ConditionWait(&submitPool.queued, &submitPool.lock);
+        }
+        --submitPool.numIdle;
+        SolitaireSortTask *task = submitPool.head;
+        submitPool.head = task->next;
+        if (!submitPool.head)
+        {
+            submitPool.tail = NULL;
+        }
+        --submitPool.numQueued;
+        MutexUnlock(&submitPool.lock);
+
+        task->status = SolitaireSortWithOptions(task->data, task->size, &task->options);
+        if (task->done)
+        {
+            task->done(task->status, task->context);
+        }
+
+        MutexLock(&submitPool.lock);
+        task->finished = 1;
+        ConditionBroadcast(&submitPool.finished);
+    }
+    THREAD_RETURN;
+}
+
+_Ret_maybenull_ SolitaireSortTask *SolitaireSortSubmit(
+    _Inout_updates_all_(size) card_t data[],
+    const size_t size,
+    _In_opt_ const SolitaireSortOptions *options,
+    _In_opt_ SolitaireSortCallback done,
+    _In_opt_ void *context)
+{
+    SolitaireSortTask *task = (SolitaireSortTask *)malloc(sizeof(SolitaireSortTask));
+    if (!task)
+    {
+        return NULL;
+    }
+    task->data = data;
+    task->size = size;
+    if (options)
+    {
+        task->options = *options;
+    }
+    else
+    {
+        memset(&task->options, 0, sizeof(task->options));
+    }
+    task->done = done;
+    task->context = context;
+    task->status = 1;
+    task->finished = 0;
+    task->next = NULL;
+
+    MutexLock(&submitPool.lock);
+    if (submitPool.numQueued + 1 > submitPool.numIdle && submitPool.numThreads < SUBMIT_POOL_THREADS)
+    {
+        Thread thread;
+        if (ThreadStart(&thread, SubmitPoolThread, NULL) == 0)
+        {
+            ThreadDetach(&thread);
+            ++submitPool.numThreads;
+        }
+        else if (submitPool.numThreads == 0)
+        {
+            // Nothing would ever run it. With other threads around it just waits its turn.
+            MutexUnlock(&submitPool.lock);
+            free(task);
+            return NULL;
+        }
+    }
+    if (submitPool.tail)
+    {
+        submitPool.tail->next = task;
+    }
+    else
+    {
+        submitPool.head = task;
+    }
+    submitPool.tail = task;
+    ++submitPool.numQueued;
+    ConditionSignal(&submitPool.queued);
+    MutexUnlock(&submitPool.lock);
+    return task;
+}
+
+_Success_(return == 0) int SolitaireSortWait(
+    _Inout_ SolitaireSortTask *task)
+{
+    MutexLock(&submitPool.lock);
+    while (!task->finished)
+    {
+        ConditionWait(&submitPool.finished, &submitPool.lock);
+    }
+    MutexUnlock(&submitPool.lock);
+    const int status = task->status;
+    free(task);
+    return status;
+}
+
+void SolitaireSortCancel(
+    _Inout_ SolitaireSortCancelToken *token)
+{
+    AtomicStore(&token->raised, 1);
+}
+
+_Success_(return == 0) int SolitaireSort(
+    _Inout_updates_all_(size) card_t *data[],
+    const size_t size)
+{
+    return SolitaireSortWithOptions(*data, size, NULL);
+}
+
+/**
+ * Every weight, by the name it goes by in a weights file.
+ */
+static const struct
+{
+    const char *name;
+    size_t offset;
+} WEIGHT_NAMES[] = {
+    {"foundFromField", offsetof(SolitaireSortWeights, foundFromField)},
+    {"foundFromHand", offsetof(SolitaireSortWeights, foundFromHand)},
+    {"reveal", offsetof(SolitaireSortWeights, reveal)},
+    {"revealDepth", offsetof(SolitaireSortWeights, revealDepth)},
+    {"handToStack", offsetof(SolitaireSortWeights, handToStack)},
+    {"merge", offsetof(SolitaireSortWeights, merge)},
+    {"handToEmpty", offsetof(SolitaireSortWeights, handToEmpty)},
+};
+
+// Constants
+enum
+{
+    NUM_WEIGHTS = sizeof(WEIGHT_NAMES) / sizeof(WEIGHT_NAMES[0]),
+    WEIGHTS_LINE_SIZE = 256,
+};
+
+int *WeightByName(
+    _Inout_ SolitaireSortWeights *weights,
+    _In_z_ const char *name)
+{
+    for (size_t i = 0; i < NUM_WEIGHTS; ++i)
+    {
+        if (strcmp(WEIGHT_NAMES[i].name, name) == 0)
+        {
+            return (int *)((char *)weights + WEIGHT_NAMES[i].offset);
+        }
+    }
+    return NULL;
+}
+
+SolitaireSortWeights SolitaireSortDefaultWeights(void)
+{
+    return DEFAULT_WEIGHTS;
+}
+
+_Success_(return == 0) int SolitaireSortReadWeights(
+    _Inout_ SolitaireSortWeights *weights,
+    _Inout_ FILE *input)
+{
+    char line[WEIGHTS_LINE_SIZE];
+    while (fgets(line, sizeof(line), input))
+    {
+        if (!strchr(line, '\n') && !feof(input))
+        {
+            return 1; // Longer than any line worth writing
+        }
+        char *comment = strchr(line, '#');
+        if (comment)
+        {
+            *comment = '\0';
+        }
+
+        char name[WEIGHTS_LINE_SIZE];
+        long value;
+        char rest;
+        const int fields = sscanf(line, "%255s %ld %c", name, &value, &rest);
+        if (fields == EOF)
+        {
+            continue; // Blank, or only a comment
+        }
+        int *weight = fields == 2 ? WeightByName(weights, name) : NULL;
+        if (!weight || value < INT_MIN || value > INT_MAX)
+        {
+            return 1;
+        }
+        *weight = (int)value;
+    }
+    return ferror(input) ? 1 : 0;
+}
+
+_Success_(return == 0) int SolitaireSortWriteWeights(
+    _In_ const SolitaireSortWeights *weights,
+    _Inout_ FILE *output)
+{
+    for (size_t i = 0; i < NUM_WEIGHTS; ++i)
+    {
+        int value;
+        memcpy(&value, (const char *)weights + WEIGHT_NAMES[i].offset, sizeof(value));
+        if (fprintf(output, "%s %d\n", WEIGHT_NAMES[i].name, value) < 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
 }
@@ -1,8 +1,282 @@
 #ifndef SOLITAIRE_SORT
 #define SOLITAIRE_SORT
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
 typedef char card_t;
 
+/**
+ * @brief How SolitaireSortWithOptions got the data sorted.
+ */
+typedef enum
+{
+    SOLITAIRE_PATH_GAME = 0,        // Played the game
+    SOLITAIRE_PATH_ALREADY_SORTED,  // Input was already in order, nothing was dealt
+    SOLITAIRE_PATH_REVERSED,        // Input was strictly descending and was reversed in place
+    SOLITAIRE_PATH_INSERTION,       // Too few cards to fill the field, insertion sorted instead
+    SOLITAIRE_PATH_CHUNKED,         // Too many cards for one game: played in chunks and merged
+    SOLITAIRE_PATH_REPLAYED,        // Sorted before: the game that won then was dealt again and its moves replayed from the catalog
+
+} SolitaireSortPath;
+
+/**
+ * @brief Hot-path event counts, for telling more losses from longer games from allocator stalls.
+ * These cost a few adds per move, so they are only kept when solitaire-sort.c is built with SOLITAIRE_SORT_COUNTERS defined to 1.
+ * Otherwise every field stays 0.
+ */
+typedef struct
+{
+    /** Candidate moves written out, over every step. The solver counts a state's moves again for each option it tries. */
+    uint64_t movesGenerated;
+    /** Moves made, draws aside. Includes moves the solver later took back. */
+    uint64_t movesExecuted;
+    /** Executed moves that took cards off a field stack rather than out of the hand. */
+    uint64_t transfers;
+    /** Face-down cards turned up. */
+    uint64_t reveals;
+    /** Times the hand was passed under the deck and drawn again. */
+    uint64_t draws;
+    /** Games dealt after the first. */
+    uint64_t retries;
+    /** Board states seen twice in one game, each of which ended that line of play. */
+    uint64_t cycles;
+    /** Heap bytes asked for by the game boards, for their arenas and undo logs. */
+    uint64_t bytesAllocated;
+
+} SolitaireSortCounters;
+
+/**
+ * @brief What a call to SolitaireSortWithOptions did.
+ */
+typedef struct
+{
+    SolitaireSortPath path;
+    /** Games started, won or not. 0 on either fast path. */
+    size_t gamesPlayed;
+    /** Moves and draws made, over every game. */
+    size_t movesPlayed;
+    /** Heap allocations made by the call. 0 for a single-threaded sort given enough scratch. */
+    size_t allocations;
+    /** Summed over every thread. */
+    SolitaireSortCounters counters;
+
+} SolitaireSortStats;
+
+/**
+ * @brief What one thread did during a call. Utilization is busyNanos / wallNanos.
+ */
+typedef struct
+{
+    /** Games started by SolitaireSortWithOptions, or decks sorted by SolitaireSortBatch. */
+    size_t tasksRun;
+    /** Decks this thread took from another thread's share of a batch. Always 0 for a single sort. */
+    size_t tasksStolen;
+    /** Time spent sorting, as opposed to waiting for work or for the other threads. */
+    uint64_t busyNanos;
+    /** Time the whole call took. The same for every thread. */
+    uint64_t wallNanos;
+    /** Just this thread's games. */
+    SolitaireSortCounters counters;
+
+} SolitaireSortThreadStats;
+
+/**
+ * @brief What a SolitaireSortEvent records.
+ */
+typedef enum
+{
+    SOLITAIRE_EVENT_DEAL = 0,  // A game was shuffled and dealt. count is the game's index, which picks its shuffle
+    SOLITAIRE_EVENT_MOVE,      // count cards went from src to dest, card being the bottom one
+    SOLITAIRE_EVENT_DRAW,      // The hand went under the deck and count fresh cards were drawn, card being the top one
+    SOLITAIRE_EVENT_SWEEP,     // Counting mode played count cards from the deck to the foundation, ending on card
+    SOLITAIRE_EVENT_UNDO,      // The solver took a move or draw back. src, dest and count are the original's
+    SOLITAIRE_EVENT_GAME_OVER, // count is 0 if the game was won, 1 if not
+
+} SolitaireSortEventKind;
+
+/**
+ * @brief One step of a game, binary and fixed-size so recording it costs a few stores rather than any formatting.
+ * Stacks are numbered as the engine numbers them: 0 is the deck, 1 the hand, 2 to 9 the field and 10 the foundation.
+ */
+typedef struct
+{
+    uint32_t count;
+    /** A SolitaireSortEventKind. */
+    uint8_t kind;
+    uint8_t src;
+    uint8_t dest;
+    card_t card;
+
+} SolitaireSortEvent;
+
+/**
+ * @brief A ring buffer of the latest events played by one thread. Only that thread ever writes to it, so it needs no locks.
+ * Once full, each new event overwrites the oldest.
+ */
+typedef struct
+{
+    /** Storage for the ring, supplied by the caller. */
+    SolitaireSortEvent *events;
+    /** How many events fit. Must be a power of two, or nothing is recorded. */
+    size_t capacity;
+    /** Events recorded since this was last zeroed. The newest is events[(written - 1) % capacity]. */
+    uint64_t written;
+
+} SolitaireSortTrace;
+
+/**
+ * @brief Bit flags for SolitaireSortOptions.flags.
+ */
+enum
+{
+    /**
+     * Counting mode. Whenever the game would otherwise have to cycle the deck looking for the next card, the dealer's
+     * per-rank tally is used to play every foundation card the deck can supply in one O(N + ranks) sweep.
+     * Pays off for large decks over few distinct cards, like the 13-rank A234567890JQK deck.
+     */
+    SOLITAIRE_SORT_BULK_FOUNDATION = 1 << 0,
+    /**
+     * Packed mode. A deck of at most 64 cards over at most 16 distinct values, like a 52-card A234567890JQK deck, is played
+     * with 4-bit cards and a bitboard of the field's tops on a board smaller than a kilobyte, with nothing allocated.
+     * It is the same game, move for move. Only used on one thread, and not while searching or tracing. Decks it can't take play as usual.
+     */
+    SOLITAIRE_SORT_PACKED = 1 << 1,
+    /**
+     * Stable mode, for SolitaireSortRecords. Records with equal keys keep their input order.
+     * Cards with equal keys are told apart by the index each one is tagged with: the earlier one has to be on top to be stacked,
+     * and the foundation takes them earliest first, so the won game is already in stable order. Plain chars have nothing to tell apart and ignore it.
+     */
+    SOLITAIRE_SORT_STABLE = 1 << 2,
+};
+
+/**
+ * @brief Lets another thread call off a sort that is taking too long. Zero it, point SolitaireSortOptions.cancel at it,
+ * and raise it with SolitaireSortCancel. It stays raised, so zero it again before reusing it.
+ */
+typedef struct
+{
+    volatile long raised;
+
+} SolitaireSortCancelToken;
+
+/**
+ * @brief What the player thinks each kind of move is worth. Every step plays the highest-scoring move it can make, the first one found on a tie,
+ * and draws only when there is none, so these decide how often games are lost. Start from SolitaireSortDefaultWeights;
+ * solitaire-sort-bench --tune searches for ones that win more per second of play of this engine's games.
+ * The C++ engine scores the same moves, and takes these through solitaire::Weights::from.
+ */
+typedef struct
+{
+    /** The top of a field stack onto the foundation. Defaults to 1000. */
+    int foundFromField;
+    /** A card from the hand onto the foundation. Defaults to 900. */
+    int foundFromHand;
+    /** A field stack's whole face-up run onto another stack, turning up the card under it. Defaults to 500. */
+    int reveal;
+    /** Added to reveal for every face-down card left under the run, so the deepest piles get dug into first. Defaults to 1. */
+    int revealDepth;
+    /** A card from the hand onto a non-empty field stack. Defaults to 300. */
+    int handToStack;
+    /** Everything on a field stack, all face up, onto another, leaving it empty. Defaults to 200. */
+    int merge;
+    /** A card from the hand onto an empty field stack. Defaults to 100. */
+    int handToEmpty;
+
+} SolitaireSortWeights;
+
+/**
+ * @brief Remembers, for inputs sorted before, which shuffle won and the moves that won it, so sorting the same input again
+ * costs one replayed game with no moves to work out and no retries. Made by SolitaireSortCreateCatalog.
+ */
+typedef struct SolitaireSortCatalog SolitaireSortCatalog;
+
+/**
+ * @brief Tuning for SolitaireSortWithOptions. Zeroed fields fall back to the defaults.
+ */
+typedef struct
+{
+    /** How many games may be played in total before giving up. Defaults to 3. */
+    size_t maxRetries;
+    /** How many games may be played at once. Defaults to 1, which plays them one after another on the calling thread. */
+    size_t numThreads;
+    /** Game i is shuffled from (seed, i), so a fixed seed makes runs reproducible. Defaults to something time-based. */
+    uint64_t seed;
+    /**
+     * Optional storage for the board, so a single-threaded sort allocates nothing at all.
+     * Used only if it is at least SolitaireSortScratchSize(size) long. Ignored with more than one thread.
+     */
+    card_t *scratch;
+    size_t scratchSize;
+    /** If not NULL, filled in before returning. */
+    SolitaireSortStats *stats;
+    /** Any of the SOLITAIRE_SORT_* flags. */
+    unsigned flags;
+    /** If not NULL, filled in with one entry per thread, so it needs room for numThreads of them. Threads that weren't needed get zeroes. */
+    SolitaireSortThreadStats *threadStats;
+    /**
+     * Solver mode. If not 0, a lost line of play is backed up and tried differently, from the same deal, rather than given up on.
+     * Each deal may take back this many moves before it counts as lost and the next shuffle is tried. The bulk sweep is not used while searching.
+     */
+    size_t searchBudget;
+    /**
+     * If not NULL, every deal, move, draw and take-back is recorded here, one ring per thread, so it needs room for numThreads of them.
+     * Rings are added to rather than cleared, so several calls can share one.
+     */
+    SolitaireSortTrace *traces;
+    /**
+     * Decks with fewer cards than this are insertion sorted rather than played, since setting up a board costs more than sorting them.
+     * Defaults to 36, the fewest cards that fill the field. 1 always plays.
+     */
+    size_t insertionThreshold;
+    /**
+     * Decks with more cards than this are cut into chunks of chunkSize, played like a SolitaireSortBatch over numThreads, and merged back.
+     * Long games cost more per card and lose more often, so a few short games and a merge come out ahead.
+     * Defaults to 1024, or to never with SOLITAIRE_SORT_BULK_FOUNDATION, whose sweep only gets cheaper per card as decks grow. SIZE_MAX never chunks.
+     */
+    size_t mergeThreshold;
+    /** Cards per chunk past mergeThreshold. Defaults to 512. solitaire-sort-bench --calibrate suggests all three for the machine it runs on. */
+    size_t chunkSize;
+    /**
+     * If not NULL, every game watches it and gives up at its next move once it is raised, as though it were lost.
+     * Batch decks not yet started are failed without being dealt.
+     */
+    SolitaireSortCancelToken *cancel;
+    /**
+     * If not NULL, the input is looked up here by a fingerprint of its cards, flags, searchBudget and weights. One seen before has the game
+     * that won it dealt again and its moves replayed, falling back to playing as usual if they no longer win. Wins are written down here.
+     * Every game is dealt from data itself then, so scratch and SOLITAIRE_SORT_PACKED are not used. Past mergeThreshold each chunk
+     * is looked up on its own, and chunks are sorted one after another rather than batched.
+     * Counting mode can't log its sweeps, so its wins are replayed by playing the winning shuffle again, which still skips the retries.
+     * Nothing is locked: calls running at the same time each need a catalog of their own.
+     */
+    SolitaireSortCatalog *catalog;
+    /** If not NULL, how the player scores its moves. Copied before the first game. Defaults to SolitaireSortDefaultWeights(). */
+    const SolitaireSortWeights *weights;
+
+} SolitaireSortOptions;
+
+/**
+ * @brief Tuning for SolitaireSortStream. Zeroed fields fall back to the defaults.
+ */
+typedef struct
+{
+    /** Most memory held at once, in bytes, chunks, boards and merge buffers together. Defaults to 64 MiB. */
+    size_t memoryBudget;
+    /**
+     * How every chunk's game is played. Can be NULL. Its threads, scratch, mergeThreshold, searchBudget, catalog and stats are not used,
+     * since they would allocate outside the budget, and only the first of its traces.
+     */
+    const SolitaireSortOptions *sort;
+
+} SolitaireSortStreamOptions;
+
 /**
  * @brief Sorts an array of chars by playing Solitaire with it.
  *
@@ -11,4 +285,181 @@ typedef char card_t;
  */
 int SolitaireSort(card_t *data[], const size_t size);
 
+/**
+ * @brief Finds where a char array stops being in order.
+ * Uses AVX2 or NEON when the CPU has it, so it is cheap enough to verify large outputs in production.
+ *
+ * @return The first index i where data[i - 1] > data[i], or size if the whole array is in order.
+ */
+size_t SolitaireSortFirstUnordered(const card_t data[], const size_t size);
+
+/**
+ * @brief How much scratch a single-threaded SolitaireSortWithOptions needs to avoid allocating.
+ * SIZE_MAX if (size) is more cards than any board can hold; a game of that many would fail whatever it was given.
+ */
+size_t SolitaireSortScratchSize(const size_t size);
+
+/**
+ * @brief Sorts an array of chars by playing Solitaire with it, possibly several games at once.
+ * Input that is already sorted is left alone, and strictly descending input is just reversed; neither deals a single card.
+ * Decks too small to fill the field are insertion sorted, and big ones are played in chunks and merged; see insertionThreshold and mergeThreshold.
+ * On one thread the foundation is built directly in data, so nothing is copied back afterwards.
+ * With more than one thread, independent games are played in parallel and the first one won is kept. The rest are called off.
+ *
+ * @param data The char array.
+ * @param size The size of the char array.
+ * @param options Can be NULL for the defaults.
+ * @return 0 on success. 1 if every game was lost, or a chunk lost every game, in which case data holds the same cards in no particular order.
+ * Also 1 if memory ran out, or there are too many cards to build a board for at all.
+ */
+int SolitaireSortWithOptions(card_t data[], const size_t size, const SolitaireSortOptions *options);
+
+/**
+ * @brief Sorts many independent char arrays, each by playing Solitaire with it.
+ * Every thread builds one board for the biggest deck it is given and reuses it for all of them,
+ * so a deck costs no allocation or teardown of its own. Decks are sorted in place, as with a single-threaded SolitaireSortWithOptions,
+ * and decks under insertionThreshold are insertion sorted the same way. Decks are never chunked and the catalog is not used.
+ * Each thread starts with an equal share of the decks and steals from the others when it runs out, so one long game can't hold up the rest.
+ *
+ * @param decks The char arrays.
+ * @param sizes The size of each char array.
+ * @param count How many decks there are.
+ * @param options Can be NULL for the defaults. numThreads spreads the decks over threads; each deck is still played on one.
+ * @param statuses Filled in with 0 for each deck that was sorted and 1 for each that lost every game.
+ * @return 0 if every deck was sorted, 1 otherwise.
+ */
+int SolitaireSortBatch(card_t *decks[], const size_t sizes[], const size_t count, const SolitaireSortOptions *options, int statuses[]);
+
+/**
+ * @brief Pulls the key out of a record for SolitaireSortRecords.
+ */
+typedef card_t (*SolitaireSortKey)(const void *record, void *context);
+
+/**
+ * @brief Sorts an array of records by a char key in each, by playing Solitaire with the keys alone.
+ * Every card carries the index of the record it came from, so whole records are only moved once a game is won:
+ * one gather into a copy in foundation order, then one copy back. Ties come out in no particular order unless SOLITAIRE_SORT_STABLE is set.
+ *
+ * @param records (count) records of (recordSize) bytes each.
+ * @param key Called once per record, before any game.
+ * @param context Handed to key as is.
+ * @param options Can be NULL for the defaults. Always played as one game on one thread, so numThreads, scratch, SOLITAIRE_SORT_PACKED,
+ * the insertion and merge thresholds and the catalog are ignored.
+ * @return 0 on success. 1 if every game was lost, memory ran out, or there are more than UINT32_MAX records; the records are untouched then.
+ */
+int SolitaireSortRecords(void *records, const size_t count, const size_t recordSize, SolitaireSortKey key, void *context, const SolitaireSortOptions *options);
+
+/**
+ * @brief Called once a submitted sort is over, on the thread that ran it.
+ * @param status What SolitaireSortWithOptions returned.
+ */
+typedef void (*SolitaireSortCallback)(int status, void *context);
+
+typedef struct SolitaireSortTask SolitaireSortTask;
+
+/**
+ * @brief Queues a SolitaireSortWithOptions for a pool of background threads and returns straight away, so the caller never blocks on a long game.
+ * The pool starts threads as tasks come in, up to 8, and keeps them until the process exits. Past that, tasks wait their turn, oldest first.
+ * The options are copied, but data and everything the options point to have to stay put until the sort is over.
+ * Give the options a cancel token to be able to call the sort off.
+ *
+ * @param done Called with the status when the sort is over, won, lost or cancelled. Can be NULL. It runs on a pool thread,
+ * so it mustn't wait on other submitted sorts: with every pool thread doing that, the ones waited on would never start.
+ * @param context Handed to done as is.
+ * @return A task for SolitaireSortWait, which has to be called on it exactly once. NULL if out of memory, or if the pool is empty
+ * and no thread could be started for it; done is never called then.
+ */
+SolitaireSortTask *SolitaireSortSubmit(card_t data[], const size_t size, const SolitaireSortOptions *options, SolitaireSortCallback done, void *context);
+
+/**
+ * @brief Waits for a submitted sort to be over, its callback included, and frees the task.
+ * @return What SolitaireSortWithOptions returned.
+ */
+int SolitaireSortWait(SolitaireSortTask *task);
+
+/**
+ * @brief Raises a cancel token. Safe from any thread, including from inside a callback.
+ */
+void SolitaireSortCancel(SolitaireSortCancelToken *token);
+
+/**
+ * @brief Makes an empty catalog for SolitaireSortOptions.catalog.
+ * @param capacity How many inputs it can remember, 64 if 0. Inputs are slotted by fingerprint, so a new one can push out an old one sooner.
+ * @return NULL if memory ran out.
+ */
+SolitaireSortCatalog *SolitaireSortCreateCatalog(const size_t capacity);
+
+/**
+ * @brief Frees a catalog and everything it remembers. NULL is ignored.
+ */
+void SolitaireSortDestroyCatalog(SolitaireSortCatalog *catalog);
+
+/**
+ * @brief Writes everything a catalog remembers to a file, for SolitaireSortLoadCatalog to read back in a later run.
+ * @return 0 on success, 1 on a write failure.
+ */
+int SolitaireSortSaveCatalog(const SolitaireSortCatalog *catalog, FILE *output);
+
+/**
+ * @brief Adds every input in a file written by SolitaireSortSaveCatalog to a catalog, pushing out whatever was in their slots.
+ * Only files written on a machine of the same byte order, by the same version of the engine, replay the same games.
+ *
+ * @param input Read to the end.
+ * @return 0 on success, 1 if input is not a catalog or is cut short, or memory ran out. Inputs read before the failure are kept.
+ */
+int SolitaireSortLoadCatalog(SolitaireSortCatalog *catalog, FILE *input);
+
+/**
+ * @brief Sorts a stream of chars too big to hold in memory.
+ * The input is read a chunk at a time and each chunk is dealt as its own game. The sorted runs are spilled to a temporary file
+ * and then k-way merged into the output. Memory stays within the budget; only the run bookkeeping is extra.
+ *
+ * @param input Read to the end.
+ * @param output Gets every byte of input, in order. Might be partly written on failure.
+ * @param options Can be NULL for the defaults.
+ * @return 0 on success. 1 if a chunk lost every game, or on a read, write or allocation failure.
+ */
+int SolitaireSortStream(FILE *input, FILE *output, const SolitaireSortStreamOptions *options);
+
+/**
+ * @brief Writes a trace's events to a file, oldest first, for SolitaireSortPrintTrace to read back later.
+ * Dumps can be appended one after another, say one per thread, and are read back in the same order.
+ *
+ * @return 0 on success, 1 on a write failure.
+ */
+int SolitaireSortWriteTrace(const SolitaireSortTrace *trace, FILE *output);
+
+/**
+ * @brief Decodes dumps written by SolitaireSortWriteTrace into one line of text per event.
+ * Only dumps written on a machine of the same byte order can be read.
+ *
+ * @param input Read to the end.
+ * @return 0 on success, 1 if input is not a dump or is cut short, or on a write failure.
+ */
+int SolitaireSortPrintTrace(FILE *input, FILE *output);
+
+/**
+ * @brief The weights the player plays with when SolitaireSortOptions.weights is NULL.
+ */
+SolitaireSortWeights SolitaireSortDefaultWeights(void);
+
+/**
+ * @brief Reads weights from a text file of "name value" lines, names as in SolitaireSortWeights. Each line sets one weight and leaves
+ * the rest as they were, so start from SolitaireSortDefaultWeights to only change some. Blank lines and anything after a # are skipped.
+ *
+ * @param input Read to the end.
+ * @return 0 on success, 1 on a read failure or a line that isn't a known name and a value that fits an int. Lines before it are kept.
+ */
+int SolitaireSortReadWeights(SolitaireSortWeights *weights, FILE *input);
+
+/**
+ * @brief Writes every weight out in the format SolitaireSortReadWeights reads.
+ * @return 0 on success, 1 on a write failure.
+ */
+int SolitaireSortWriteWeights(const SolitaireSortWeights *weights, FILE *output);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,516 @@
+/**
+ * @file benchmark.cpp
+ * @brief Times the C and C++ engines against qsort and std::sort over input size, key distribution and rule set.
+ *
+ * Usage: solitaire-sort-bench [maxSize]
+ *        solitaire-sort-bench --calibrate
+ *        solitaire-sort-bench --tune [file...] > weights
+ * Sizes go up by powers of ten from 10 to maxSize, which defaults to 1000000. 10000000 works too, it just takes a while.
+ * Every sorted output is checked against std::sort, so a wrong answer stops the run rather than turning up as a fast time.
+ * The C rows play every deck as one game; the hybrid row leaves the choice of insertion sort, game or chunk-and-merge to the defaults.
+ *
+ * --calibrate times those choices against each other on uniform and 13-rank input instead, and prints the
+ * insertionThreshold, chunkSize and mergeThreshold that came out fastest for each rule set.
+ *
+ * --tune searches for the move weights that win the most first games per CPU second over a corpus: the files named, cut into
+ * decks of 512, or generated uniform, few-unique and 13-rank decks without any. It prints them in the format solitaire-sort-cli -w
+ * and SolitaireSortReadWeights read, and its progress on stderr. Fewer lost games means fewer retries.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include "solitaire-sort.hpp"
+#include "../c/solitaire-sort.h"
+
+namespace
+{
+    /** Counts every operator new in the process. The C engine uses malloc, and reports its own allocations instead. */
+    std::atomic<std::size_t> numAllocations{0};
+
+    enum Distribution
+    {
+        DIST_UNIFORM = 0,
+        DIST_SORTED,
+        DIST_REVERSED,
+        DIST_FEW_UNIQUE,
+        DIST_DECK,
+        NUM_DISTRIBUTIONS,
+    };
+
+    const char *const distributionNames[NUM_DISTRIBUTIONS] = {"uniform", "sorted", "reversed", "few-unique", "13-rank"};
+
+    std::vector<char> make_input(Distribution distribution, std::size_t size, std::mt19937_64 &engine)
+    {
+        static const char cardOptions[] = "A234567890JQK"; // Same deck as example.ts
+        std::vector<char> data(size);
+        for (char &card : data)
+        {
+            const auto value = engine();
+            switch (distribution)
+            {
+            case DIST_FEW_UNIQUE:
+                card = static_cast<char>('a' + value % 4);
+                break;
+            case DIST_DECK:
+                card = cardOptions[value % (sizeof(cardOptions) - 1)];
+                break;
+            default:
+                card = static_cast<char>(value);
+                break;
+            }
+        }
+        if (distribution == DIST_SORTED)
+        {
+            std::sort(data.begin(), data.end());
+        }
+        else if (distribution == DIST_REVERSED)
+        {
+            std::sort(data.begin(), data.end(), std::greater<>());
+        }
+        return data;
+    }
+
+    /**
+     * One row of the report, summed over every trial.
+     */
+    struct Result
+    {
+        double nanos = 0;
+        std::size_t trials = 0;
+        std::size_t wins = 0;
+        /** Left at 0 where the engine can't say. */
+        std::size_t games = 0;
+        std::size_t moves = 0;
+        std::size_t allocations = 0;
+        bool countsGames = false;
+    };
+
+    /**
+     * Sorts a copy of the input with one engine. Stops the whole run if the sort claims success and gets it wrong.
+     */
+    template <class Sorter>
+    void run_trial(const std::vector<char> &input, const std::vector<char> &expected, Result &result, Sorter sorter)
+    {
+        std::vector<char> data = input;
+        const std::size_t allocationsBefore = numAllocations;
+        const auto start = std::chrono::steady_clock::now();
+        const bool won = sorter(data, result);
+        const auto stop = std::chrono::steady_clock::now();
+        result.allocations += numAllocations - allocationsBefore;
+        result.nanos += std::chrono::duration<double, std::nano>(stop - start).count();
+        ++result.trials;
+
+        if (won)
+        {
+            ++result.wins;
+            if (data != expected)
+            {
+                std::fprintf(stderr, "MISMATCH at size %lu\n", static_cast<unsigned long>(input.size()));
+                std::exit(1);
+            }
+        }
+    }
+
+    void print_row(const char *engine, const char *rules, Distribution distribution, std::size_t size, const Result &result)
+    {
+        const double trials = static_cast<double>(result.trials);
+        std::printf("%-12s %-12s %-11s %9lu %10.2f %7.1f%%", engine, rules, distributionNames[distribution],
+                    static_cast<unsigned long>(size), result.nanos / trials / static_cast<double>(size ? size : 1),
+                    100.0 * static_cast<double>(result.wins) / trials);
+        if (result.countsGames)
+        {
+            std::printf(" %10.2f %12.1f", static_cast<double>(result.games) / trials,
+                        result.games ? static_cast<double>(result.moves) / static_cast<double>(result.games) : 0.0);
+        }
+        else
+        {
+            std::printf(" %10s %12s", "-", "-");
+        }
+        std::printf(" %11.2f\n", static_cast<double>(result.allocations) / trials);
+    }
+
+    int compare_chars(const void *a, const void *b)
+    {
+        return *static_cast<const char *>(a) - *static_cast<const char *>(b);
+    }
+
+    SolitaireSortOptions engine_options(unsigned flags, std::uint64_t seed)
+    {
+        SolitaireSortOptions options;
+        std::memset(&options, 0, sizeof(options));
+        options.seed = seed;
+        options.flags = flags;
+        return options;
+    }
+
+    /** Options that play every deck as a single game, whatever its size. */
+    SolitaireSortOptions game_only_options(unsigned flags, std::uint64_t seed)
+    {
+        SolitaireSortOptions options = engine_options(flags, seed);
+        options.insertionThreshold = 1;
+        options.mergeThreshold = SIZE_MAX;
+        return options;
+    }
+
+    bool c_engine(std::vector<char> &data, Result &result, SolitaireSortOptions options)
+    {
+        SolitaireSortStats stats;
+        options.stats = &stats;
+        const int status = SolitaireSortWithOptions(data.data(), data.size(), &options);
+        result.countsGames = true;
+        result.games += stats.gamesPlayed;
+        result.moves += stats.movesPlayed;
+        result.allocations += stats.allocations;
+        return status == 0;
+    }
+
+    /**
+     * Mean nanoseconds per card for sorting fresh uniform and 13-rank decks of (size) with (options), losses included.
+     */
+    double time_options(std::size_t size, const SolitaireSortOptions &options, std::mt19937_64 &engine)
+    {
+        const std::size_t trials = std::max<std::size_t>(4, std::min<std::size_t>(400, 400000 / size));
+        double nanos = 0;
+        for (std::size_t t = 0; t < trials; ++t)
+        {
+            for (const Distribution distribution : {DIST_UNIFORM, DIST_DECK})
+            {
+                std::vector<char> data = make_input(distribution, size, engine);
+                SolitaireSortOptions trial = options;
+                trial.seed = t + 1;
+                const auto start = std::chrono::steady_clock::now();
+                SolitaireSortWithOptions(data.data(), data.size(), &trial);
+                const auto stop = std::chrono::steady_clock::now();
+                nanos += std::chrono::duration<double, std::nano>(stop - start).count();
+            }
+        }
+        return nanos / static_cast<double>(2 * trials * size);
+    }
+
+    /**
+     * Finds the hybrid thresholds that suit this machine, one rule set at a time:
+     * the smallest size where a game beats insertion sort, the fastest chunk size for a big deck,
+     * and the smallest size where chunking at that size beats one game.
+     */
+    void calibrate()
+    {
+        std::mt19937_64 engine(20230605);
+        static const unsigned ruleFlags[] = {0, SOLITAIRE_SORT_BULK_FOUNDATION};
+        static const char *const ruleNames[] = {"classic", "counting"};
+        for (std::size_t r = 0; r < 2; ++r)
+        {
+            SolitaireSortOptions game = game_only_options(ruleFlags[r], 0);
+            SolitaireSortOptions insertion = game;
+            insertion.insertionThreshold = SIZE_MAX;
+
+            // Insertion sort is quadratic, so it loses eventually; the doubling finds roughly where.
+            const std::size_t maxInsertion = 1 << 13;
+            std::size_t insertionThreshold = 0;
+            for (std::size_t size = 8; size <= maxInsertion && insertionThreshold == 0; size *= 2)
+            {
+                if (time_options(size, game, engine) < time_options(size, insertion, engine))
+                {
+                    insertionThreshold = size;
+                }
+            }
+
+            const std::size_t bigDeck = 1 << 16;
+            std::size_t chunkSize = 0;
+            double best = 0;
+            for (std::size_t size = 256; size <= bigDeck / 4; size *= 2)
+            {
+                SolitaireSortOptions chunked = game;
+                chunked.mergeThreshold = 1;
+                chunked.chunkSize = size;
+                const double nanos = time_options(bigDeck, chunked, engine);
+                if (chunkSize == 0 || nanos < best)
+                {
+                    chunkSize = size;
+                    best = nanos;
+                }
+            }
+
+            SolitaireSortOptions chunked = game;
+            chunked.mergeThreshold = 1;
+            chunked.chunkSize = chunkSize;
+            std::size_t mergeThreshold = 0;
+            for (std::size_t size = 2 * chunkSize; size <= bigDeck && mergeThreshold == 0; size *= 2)
+            {
+                if (time_options(size, chunked, engine) < time_options(size, game, engine))
+                {
+                    mergeThreshold = size / 2;
+                }
+            }
+
+            std::printf("%-9s insertionThreshold = %lu%s, chunkSize = %lu, mergeThreshold = ", ruleNames[r],
+                        static_cast<unsigned long>(insertionThreshold ? insertionThreshold : maxInsertion), insertionThreshold ? "" : " or more",
+                        static_cast<unsigned long>(chunkSize));
+            if (mergeThreshold)
+            {
+                std::printf("%lu\n", static_cast<unsigned long>(mergeThreshold));
+            }
+            else
+            {
+                std::printf("SIZE_MAX (one game was always faster up to %lu)\n", static_cast<unsigned long>(bigDeck));
+            }
+        }
+    }
+
+    /** Cards per deck in the tuning corpus: the default chunk size, as big as a game gets by default. */
+    const std::size_t TUNE_DECK_SIZE = 512;
+    /** Generated decks of each kind, when no files are given. */
+    const std::size_t TUNE_DECKS_PER_KIND = 40;
+    /** How much better a change has to score to be kept, so noise in the timing isn't taken for an improvement. */
+    const double TUNE_MARGIN = 0.02;
+    /** Times the corpus is played per score. The games are the same every time, so only the fastest pass counts. */
+    const int TUNE_PASSES = 3;
+
+    /**
+     * Every file cut into decks of TUNE_DECK_SIZE, the last one shorter, or generated decks if there are no files.
+     * An empty corpus means a file couldn't be read.
+     */
+    std::vector<std::vector<char>> tuning_corpus(int numFiles, char *files[])
+    {
+        std::vector<std::vector<char>> corpus;
+        for (int f = 0; f < numFiles; ++f)
+        {
+            std::ifstream file(files[f], std::ios::binary);
+            if (!file)
+            {
+                std::fprintf(stderr, "%s: couldn't open\n", files[f]);
+                return {};
+            }
+            const std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            for (std::size_t start = 0; start < bytes.size(); start += TUNE_DECK_SIZE)
+            {
+                const std::size_t end = std::min(bytes.size(), start + TUNE_DECK_SIZE);
+                corpus.emplace_back(bytes.begin() + static_cast<std::ptrdiff_t>(start), bytes.begin() + static_cast<std::ptrdiff_t>(end));
+            }
+        }
+        if (numFiles == 0)
+        {
+            std::mt19937_64 engine(20230605);
+            for (const Distribution distribution : {DIST_UNIFORM, DIST_FEW_UNIQUE, DIST_DECK})
+            {
+                for (std::size_t i = 0; i < TUNE_DECKS_PER_KIND; ++i)
+                {
+                    corpus.push_back(make_input(distribution, TUNE_DECK_SIZE, engine));
+                }
+            }
+        }
+        return corpus;
+    }
+
+    struct TuneScore
+    {
+        std::size_t wins = 0;
+        /** Decks that needed a game at all. */
+        std::size_t games = 0;
+        double seconds = 0;
+
+        double value() const
+        {
+            return static_cast<double>(wins) / std::max(seconds, 1e-9);
+        }
+    };
+
+    /**
+     * Plays one game of every deck in the corpus, each with its own fixed seed, and counts the wins and the CPU time, losses included.
+     */
+    TuneScore play_corpus(const std::vector<std::vector<char>> &corpus, const SolitaireSortWeights &weights)
+    {
+        TuneScore score;
+        for (int pass = 0; pass < TUNE_PASSES; ++pass)
+        {
+            TuneScore played;
+            const std::clock_t start = std::clock();
+            for (std::size_t i = 0; i < corpus.size(); ++i)
+            {
+                std::vector<char> data = corpus[i];
+                SolitaireSortStats stats;
+                SolitaireSortOptions options = game_only_options(0, i + 1);
+                options.maxRetries = 1;
+                options.weights = &weights;
+                options.stats = &stats;
+                const int status = SolitaireSortWithOptions(data.data(), data.size(), &options);
+                played.games += stats.gamesPlayed;
+                played.wins += stats.gamesPlayed != 0 && status == 0;
+            }
+            played.seconds = static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC;
+            if (pass == 0 || played.seconds < score.seconds)
+            {
+                score = played;
+            }
+        }
+        return score;
+    }
+
+    void print_score(const char *what, const TuneScore &score)
+    {
+        std::fprintf(stderr, "%-10s %lu of %lu won in %.3f s, %.1f wins per second\n", what, static_cast<unsigned long>(score.wins),
+                     static_cast<unsigned long>(score.games), score.seconds, score.value());
+    }
+
+    /**
+     * Coordinate descent from the defaults: nudges one weight at a time up and down, keeps whatever scores better,
+     * and halves the nudge once none of them help. revealDepth is per card, so it moves in much smaller steps than the rest.
+     */
+    int tune(int numFiles, char *files[])
+    {
+        const std::vector<std::vector<char>> corpus = tuning_corpus(numFiles, files);
+        if (corpus.empty())
+        {
+            return 1;
+        }
+
+        static int SolitaireSortWeights::*const fields[] = {
+            &SolitaireSortWeights::foundFromField, &SolitaireSortWeights::foundFromHand, &SolitaireSortWeights::reveal,
+            &SolitaireSortWeights::revealDepth, &SolitaireSortWeights::handToStack, &SolitaireSortWeights::merge,
+            &SolitaireSortWeights::handToEmpty,
+        };
+        const SolitaireSortWeights defaults = SolitaireSortDefaultWeights();
+        SolitaireSortWeights best = defaults;
+        TuneScore bestScore = play_corpus(corpus, best);
+        const TuneScore defaultScore = bestScore;
+        print_score("defaults", defaultScore);
+
+        for (int step = 256; step >= 4; step /= 2)
+        {
+            // Timing drifts, so the score to beat is taken again at every step size.
+            bestScore = play_corpus(corpus, best);
+            for (bool improved = true; improved;)
+            {
+                improved = false;
+                for (int SolitaireSortWeights::*const field : fields)
+                {
+                    for (const int sign : {1, -1})
+                    {
+                        SolitaireSortWeights candidate = best;
+                        candidate.*field += sign * (field == &SolitaireSortWeights::revealDepth ? std::max(1, step / 64) : step);
+                        const TuneScore score = play_corpus(corpus, candidate);
+                        if (score.wins >= bestScore.wins && score.value() > bestScore.value() * (1 + TUNE_MARGIN))
+                        {
+                            best = candidate;
+                            bestScore = score;
+                            improved = true;
+                            print_score("improved", score);
+                        }
+                    }
+                }
+            }
+        }
+
+        print_score("tuned", bestScore);
+        std::printf("# %lu decks: %lu of %lu first games won with these, %lu with the defaults\n", static_cast<unsigned long>(corpus.size()),
+                    static_cast<unsigned long>(bestScore.wins), static_cast<unsigned long>(bestScore.games),
+                    static_cast<unsigned long>(defaultScore.wins));
+        return SolitaireSortWriteWeights(&best, stdout);
+    }
+}
+
+void *operator new(std::size_t size)
+{
+    ++numAllocations;
+    if (void *block = std::malloc(size ? size : 1))
+    {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *block) noexcept
+{
+    std::free(block);
+}
+
+void operator delete(void *block, std::size_t) noexcept
+{
+    std::free(block);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && std::strcmp(argv[1], "--calibrate") == 0)
+    {
+        calibrate();
+        return 0;
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--tune") == 0)
+    {
+        return tune(argc - 2, argv + 2);
+    }
+    const std::size_t maxSize = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+    std::printf("%-12s %-12s %-11s %9s %10s %8s %10s %12s %11s\n", "engine", "rules", "input", "size", "ns/elem", "wins",
+                "games/sort", "moves/game", "allocs/sort");
+
+    std::mt19937_64 engine(20230605);
+    for (std::size_t size = 10; size <= maxSize; size *= 10)
+    {
+        // Enough trials for small sizes to be timed at all, without the big ones taking all day.
+        const std::size_t trials = std::max<std::size_t>(1, std::min<std::size_t>(1000, 1000000 / size));
+
+        for (std::size_t d = 0; d < NUM_DISTRIBUTIONS; ++d)
+        {
+            const Distribution distribution = static_cast<Distribution>(d);
+            Result qsortResult, stdSortResult, cResult, cBulkResult, cPackedResult, cHybridResult;
+            Result cppResults[solitaire::NUM_RULE_SETS];
+
+            for (std::size_t t = 0; t < trials; ++t)
+            {
+                const std::vector<char> input = make_input(distribution, size, engine);
+                std::vector<char> expected = input;
+                std::sort(expected.begin(), expected.end());
+
+                run_trial(input, expected, qsortResult, [](std::vector<char> &data, Result &)
+                          {
+                              std::qsort(data.data(), data.size(), 1, compare_chars);
+                              return true; });
+                run_trial(input, expected, stdSortResult, [](std::vector<char> &data, Result &)
+                          {
+                              std::sort(data.begin(), data.end());
+                              return true; });
+                run_trial(input, expected, cResult, [t](std::vector<char> &data, Result &result)
+                          { return c_engine(data, result, game_only_options(0, t + 1)); });
+                run_trial(input, expected, cBulkResult, [t](std::vector<char> &data, Result &result)
+                          { return c_engine(data, result, game_only_options(SOLITAIRE_SORT_BULK_FOUNDATION, t + 1)); });
+                run_trial(input, expected, cPackedResult, [t](std::vector<char> &data, Result &result)
+                          { return c_engine(data, result, game_only_options(SOLITAIRE_SORT_PACKED, t + 1)); });
+                run_trial(input, expected, cHybridResult, [t](std::vector<char> &data, Result &result)
+                          { return c_engine(data, result, engine_options(0, t + 1)); });
+                for (std::size_t r = 0; r < solitaire::NUM_RULE_SETS; ++r)
+                {
+                    run_trial(input, expected, cppResults[r], [r](std::vector<char> &data, Result &)
+                              { return solitaire::solitaire_sort(static_cast<solitaire::RuleSet>(r), data.begin(), data.end()); });
+                }
+            }
+
+            static const char *const ruleNames[solitaire::NUM_RULE_SETS] = {"classic", "klondike", "draw-one"};
+            print_row("qsort", "-", distribution, size, qsortResult);
+            print_row("std::sort", "-", distribution, size, stdSortResult);
+            print_row("C", "classic", distribution, size, cResult);
+            print_row("C", "counting", distribution, size, cBulkResult);
+            if (size <= 64)
+            {
+                print_row("C", "packed", distribution, size, cPackedResult); // Plays as classic above that
+            }
+            print_row("C", "hybrid", distribution, size, cHybridResult);
+            for (std::size_t r = 0; r < solitaire::NUM_RULE_SETS; ++r)
+            {
+                print_row("C++", ruleNames[r], distribution, size, cppResults[r]);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+#include <cstdio>
+#include <vector>
+#include "solitaire-sort.hpp"
+
+int main()
+{
+    std::puts("Program start");
+
+    std::vector<char> data = {
+        '1',
+        '5',
+        '2',
+        '5',
+        '3',
+        '9',
+        '6',
+        '9',
+        '7',
+        '0',
+        '4',
+    };
+
+    std::puts("Unsorted");
+    for (char card : data)
+    {
+        std::printf("%c, ", card);
+    }
+    std::puts("");
+
+    const bool success = solitaire::solitaire_sort(data.begin(), data.end());
+
+    std::puts("Sorted");
+    for (char card : data)
+    {
+        std::printf("%c, ", card);
+    }
+    std::puts("");
+
+    return success ? 0 : 1;
+}
@@ -1,5 +1,5 @@
 #include "solitaire-sort.hpp"
 
-void SolitaireSort()
-{
-}
+// The engine is header-only. Instantiating the char version here mirrors the C port and keeps the header honest.
+template bool solitaire::solitaire_sort<char *, std::less<>>(char *, char *, std::less<>);
+template bool solitaire::solitaire_sort<char *, std::less<>>(solitaire::RuleSet, char *, char *, std::less<>, const solitaire::Weights &);
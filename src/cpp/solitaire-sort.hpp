@@ -1,3 +1,1025 @@
+/**
+ * @file solitaire-sort.hpp
+ * @author Henry Wilder (henrythepony@gmail.com)
+ * @brief Sorting algorithm which plays a game of faux-solitare to order elements.
+ * @version 0.1
+ * @date 2023-06-05
+ *
+ * @copyright Copyright (c) 2023
+ *
+ * @remark This project is explicitly a joke and not meant for production.
+ *
+ * Header-only so the comparator gets inlined into every stacking check instead of going through a byte-only path.
+ *
+ * The rules, shared with the C version:
+ * - The deck is dealt onto the field: stack i gets i + 1 cards, and only the top one is face up.
+ * - The hand holds up to NUM_CARDS_IN_HAND cards, any of which can be played. Drawing slides the hand under the deck
+ *   and pulls the next cards off the top.
+ * - A card (or a face-up run starting at it) can go onto a field stack whose top is not less than it, or onto an empty stack.
+ *   That keeps the face-up part of every stack ordered, smallest on top.
+ * - A card can go onto the foundation once nothing left in play is less than it. Like knowing the ace comes first in real solitaire.
+ *   The dealer tracks this without sorting anything: the smallest face-down card per stack is kept as a prefix minimum,
+ *   and the deck is a queue that keeps its running minimum.
+ * - The game is won when the foundation holds every card, which makes it sorted by construction.
+ *   It is lost when a full pass through the deck goes by without any other move being possible.
+ */
 #pragma once
 
-void SolitaireSort();
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace solitaire
+{
+    // Constants
+    enum : std::size_t
+    {
+        NUM_FIELD_STACKS = 8,
+        NUM_CARDS_IN_HAND = 3,
+        MAX_RETRIES = 3,
+        ASYNC_THREADS = 8, // Most sorts solitaire_sort_async runs at once, like SolitaireSortSubmit's pool in the C version
+    };
+
+    /**
+     * A rule set, fixed at compile time so every engine built from one has its stack loops unrolled and its hand checks folded away.
+     * Same knobs as the TS rules namespace, plus the field width and retry count the ports hard-code.
+     */
+    template <std::size_t FieldStacks, std::size_t HandSize, bool HandAllowRandomAccess, std::size_t MaxRetries>
+    struct Rules
+    {
+        static_assert(FieldStacks != 0, "Need somewhere to deal to");
+        static_assert(HandSize != 0, "Need to be able to draw");
+
+        static constexpr std::size_t NUM_FIELD_STACKS = FieldStacks;
+        static constexpr std::size_t NUM_CARDS_IN_HAND = HandSize;
+        /** Whether any card in the hand can be played, or only the last one drawn. */
+        static constexpr bool HAND_ALLOW_RANDOM_ACCESS = HandAllowRandomAccess;
+        static constexpr std::size_t MAX_RETRIES = MaxRetries;
+    };
+
+    /** The rules every other port plays by. */
+    using ClassicRules = Rules<NUM_FIELD_STACKS, NUM_CARDS_IN_HAND, true, MAX_RETRIES>;
+    /** Closer to real Klondike: seven stacks, draw three, and only the last card drawn can be played. Much harder; big decks rarely win. */
+    using KlondikeRules = Rules<7, 3, false, MAX_RETRIES>;
+    /** Seven stacks, draw one. */
+    using DrawOneRules = Rules<7, 1, false, MAX_RETRIES>;
+
+    /**
+     * The rule sets that can be picked at runtime. Each one is its own fully specialized engine.
+     */
+    enum RuleSet : std::size_t
+    {
+        RULES_CLASSIC = 0,
+        RULES_KLONDIKE,
+        RULES_DRAW_ONE,
+        NUM_RULE_SETS,
+    };
+
+    /**
+     * What the player thinks each kind of move is worth, the same knobs as SolitaireSortWeights in the C version.
+     * Every step plays the highest-scoring move it can make, the first one found on a tie, and draws only when there is none.
+     */
+    struct Weights
+    {
+        /** The top of a field stack onto the foundation. */
+        int foundFromField = 1000;
+        /** A card from the hand onto the foundation. */
+        int foundFromHand = 900;
+        /** A field stack's whole face-up run onto another stack, turning up the card under it. */
+        int reveal = 500;
+        /** Added to reveal for every face-down card left under the run. */
+        int revealDepth = 1;
+        /** A card from the hand onto a non-empty field stack. */
+        int handToStack = 300;
+        /** Everything on a field stack, all face up, onto another, leaving it empty. */
+        int merge = 200;
+        /** A card from the hand onto an empty field stack. */
+        int handToEmpty = 100;
+
+        /**
+         * Takes anything with the same fields, such as the SolitaireSortWeights that SolitaireSortReadWeights fills in
+         * from a solitaire-sort-bench --tune file, without this header needing the C one.
+         */
+        template <class Other>
+        static Weights from(const Other &other)
+        {
+            Weights weights;
+            weights.foundFromField = other.foundFromField;
+            weights.foundFromHand = other.foundFromHand;
+            weights.reveal = other.reveal;
+            weights.revealDepth = other.revealDepth;
+            weights.handToStack = other.handToStack;
+            weights.merge = other.merge;
+            weights.handToEmpty = other.handToEmpty;
+            return weights;
+        }
+    };
+
+    namespace detail
+    {
+        template <class F, std::size_t... I>
+        void unroll(F &&f, std::index_sequence<I...>)
+        {
+            (f(I), ...);
+        }
+
+        /**
+         * Calls f(0) through f(N - 1) with the loop written out in full. Return from f to skip to the next index.
+         */
+        template <std::size_t N, class F>
+        void unroll(F &&f)
+        {
+            unroll(f, std::make_index_sequence<N>{});
+        }
+
+        /**
+         * A queue of face-down cards that can also tell you its smallest card in O(1).
+         * Cards are pulled from the top (front) and slid underneath (back), exactly like the deck in the other ports.
+         *
+         * Positions only ever increase; a position maps to slot (position % capacity),
+         * so the minimum can be tracked by position rather than by value.
+         */
+        template <class T, class Compare>
+        class Deck
+        {
+        public:
+            /**
+             * Takes ownership of the cards and shuffles them. The deck will never hold more cards than it starts with.
+             */
+            template <class Engine>
+            void reset(std::vector<T> &&cards, Engine &engine, Compare &comp)
+            {
+                slots = std::move(cards);
+                std::shuffle(slots.begin(), slots.end(), engine);
+                capacity = slots.size();
+                minima.assign(capacity, 0);
+                top = 0;
+                bottom = 0;
+                minTop = 0;
+                minBottom = 0;
+                while (bottom < capacity)
+                {
+                    track_bottom(comp);
+                }
+            }
+
+            /**
+             * Tells how many cards are in the deck.
+             */
+            std::size_t num_cards() const
+            {
+                return bottom - top;
+            }
+
+            /**
+             * The smallest card in the deck. Do not use if the deck is empty.
+             */
+            const T &min_card() const
+            {
+                return slots[minima[minTop % capacity] % capacity];
+            }
+
+            /**
+             * Slides a card underneath the deck.
+             */
+            void push_to_bottom(T &&card, Compare &comp)
+            {
+                slots[bottom % capacity] = std::move(card);
+                track_bottom(comp);
+            }
+
+            /**
+             * Removes and returns the top card. Do not use if the deck is empty.
+             */
+            T pull_from_top()
+            {
+                if (minima[minTop % capacity] == top)
+                {
+                    ++minTop;
+                }
+                return std::move(slots[top++ % capacity]);
+            }
+
+        private:
+            std::vector<T> slots;
+            std::vector<std::size_t> minima; // Positions of the cards that could still become the minimum, in non-decreasing order.
+            std::size_t capacity = 0;
+            std::size_t top = 0;
+            std::size_t bottom = 0;
+            std::size_t minTop = 0;
+            std::size_t minBottom = 0;
+
+            /**
+             * Accounts for the card just written to the bottom slot.
+             */
+            void track_bottom(Compare &comp)
+            {
+                const T &card = slots[bottom % capacity];
+                // Anything above that is greater than the new card can never be the minimum again while the new card is below it.
+                while (minBottom != minTop && comp(card, slots[minima[(minBottom - 1) % capacity] % capacity]))
+                {
+                    --minBottom;
+                }
+                minima[minBottom % capacity] = bottom;
+                ++minBottom;
+                ++bottom;
+            }
+        };
+
+        /**
+         * A stack of cards on the field.
+         * Has faceup and facedown cards.
+         */
+        template <class T>
+        struct FieldStack
+        {
+            /** The back (last element) is called the top, while the front (first element) is called the bottom. */
+            std::vector<T> cards;
+            /** downMin[i] is the index of the smallest card in cards[0..i]. Only meaningful for the face-down part. */
+            std::vector<std::size_t> downMin;
+            /** The number of cards considered public, counts starting from the top. */
+            std::size_t faceUp = 0;
+
+            std::size_t num_cards() const { return cards.size(); }
+            std::size_t face_down() const { return cards.size() - faceUp; }
+            const T &top_card() const { return cards.back(); }
+        };
+
+        /**
+         * Where a card came from or is going to. Field stacks are numbered from 0; the rest are named, well clear of any field width.
+         */
+        enum Pile : std::size_t
+        {
+            PILE_HAND = static_cast<std::size_t>(-3),
+            PILE_FOUNDATION,
+            PILE_NONE,
+        };
+
+        /**
+         * A performable move in the game.
+         */
+        struct Move
+        {
+            std::size_t src = PILE_NONE;
+            std::size_t dest = PILE_NONE;
+            /** Number of cards moved for field sources, index of the card for the hand. */
+            std::size_t count = 0;
+            /** Value of playing this move. */
+            int score = 0;
+        };
+
+        enum GameStatus
+        {
+            GAME_LOSS = 0, // No moves possible, didn't win.
+            GAME_PLAYING,  // Moves possible.
+            GAME_WIN,      // No moves possible, won.
+        };
+
+        /**
+         * Storage for gameplay elements, plus the AI player that plays them.
+         */
+        template <class T, class Compare, class Rules>
+        class Game
+        {
+        public:
+            explicit Game(Compare comp, const Weights &weights = Weights()) : comp(std::move(comp)), weights(weights) {}
+
+            /**
+             * Sets up the game.
+             * 1. Shuffles the deck
+             * 2. Deals cards to the field
+             * 3. Deals cards to hand
+             */
+            template <class Engine>
+            void setup(std::vector<T> &&cards, Engine &engine)
+            {
+                total = cards.size();
+                deck.reset(std::move(cards), engine, comp);
+
+                hand.clear();
+                hand.reserve(Rules::NUM_CARDS_IN_HAND);
+                foundation.clear();
+                foundation.reserve(total);
+                for (FieldStack<T> &stack : field)
+                {
+                    stack.cards.clear();
+                    stack.cards.reserve(total);
+                    stack.downMin.clear();
+                    stack.faceUp = 0;
+                }
+
+                deal_to_field();
+                draw();
+                stalledDraws = 0;
+            }
+
+            /**
+             * Plays until the game is decided, or as a loss once (cancelled) is raised.
+             */
+            GameStatus play(const std::atomic<bool> *cancelled = nullptr)
+            {
+                GameStatus status;
+                while ((status = try_make_move()) == GAME_PLAYING)
+                {
+                    if (cancelled && cancelled->load(std::memory_order_relaxed))
+                    {
+                        return GAME_LOSS;
+                    }
+                }
+                return status;
+            }
+
+            /**
+             * The cards on the foundation, in order. Only complete after a win.
+             */
+            std::vector<T> &foundation_cards()
+            {
+                return foundation;
+            }
+
+        private:
+            Compare comp;
+            Weights weights;
+            Deck<T, Compare> deck;
+            std::vector<T> hand;
+            FieldStack<T> field[Rules::NUM_FIELD_STACKS];
+            std::vector<T> foundation;
+            std::size_t total = 0;
+            /** Draws in a row without any other move. A full pass through the deck like that means nothing can be done. */
+            std::size_t stalledDraws = 0;
+
+            /**
+             * Each stack in the field gets one more card than the previous, and the first gets 1.
+             * Stops early if the deck runs out.
+             */
+            void deal_to_field()
+            {
+                unroll<Rules::NUM_FIELD_STACKS>([&](std::size_t i)
+                {
+                    FieldStack<T> &stack = field[i];
+                    for (std::size_t j = 0; j <= i && deck.num_cards() != 0; ++j)
+                    {
+                        stack.cards.push_back(deck.pull_from_top());
+                        const std::size_t last = stack.cards.size() - 1;
+                        const bool newMin = last == 0 || comp(stack.cards[last], stack.cards[stack.downMin[last - 1]]);
+                        stack.downMin.push_back(newMin ? last : stack.downMin[last - 1]);
+                    }
+                    stack.faceUp = stack.cards.empty() ? 0 : 1;
+                });
+            }
+
+            /**
+             * Passes the full contents of the hand to the bottom of the deck, then pulls
+             * up to Rules::NUM_CARDS_IN_HAND cards from the top of the deck into the hand.
+             */
+            void draw()
+            {
+                for (T &card : hand)
+                {
+                    deck.push_to_bottom(std::move(card), comp);
+                }
+                hand.clear();
+                while (hand.size() < Rules::NUM_CARDS_IN_HAND && deck.num_cards() != 0)
+                {
+                    hand.push_back(deck.pull_from_top());
+                }
+            }
+
+            /**
+             * Flips the next face-down card of a stack if the face-up run was just cleared off it.
+             */
+            void reveal_if_needed(FieldStack<T> &stack)
+            {
+                if (stack.faceUp == 0 && stack.num_cards() != 0)
+                {
+                    stack.faceUp = 1;
+                }
+            }
+
+            /**
+             * Finds the smallest card still in play, face down or not.
+             * Face-up cards below a stack's top are never smaller than the top, so tops are all that need looking at.
+             */
+            const T *smallest_remaining() const
+            {
+                const T *smallest = nullptr;
+                auto consider = [&](const T &card)
+                {
+                    if (!smallest || comp(card, *smallest))
+                    {
+                        smallest = &card;
+                    }
+                };
+                if (deck.num_cards() != 0)
+                {
+                    consider(deck.min_card());
+                }
+                unroll<Rules::NUM_FIELD_STACKS>([&](std::size_t i)
+                {
+                    const FieldStack<T> &stack = field[i];
+                    if (stack.face_down() != 0)
+                    {
+                        consider(stack.cards[stack.downMin[stack.face_down() - 1]]);
+                    }
+                    if (stack.num_cards() != 0)
+                    {
+                        consider(stack.top_card());
+                    }
+                });
+                for (const T &card : hand)
+                {
+                    consider(card);
+                }
+                return smallest;
+            }
+
+            /**
+             * Whether a run whose bottom card is (bottom) can be placed on the stack.
+             */
+            bool stackable(const FieldStack<T> &dest, const T &bottom) const
+            {
+                return dest.num_cards() == 0 || !comp(dest.top_card(), bottom);
+            }
+
+            /**
+             * The best field stack to put a run with (bottom) at its base on: the non-empty stack with the smallest top that
+             * still takes it, falling back to an empty stack. Returns PILE_NONE if nothing fits.
+             */
+            std::size_t best_destination(const T &bottom, std::size_t exclude, bool allowEmpty) const
+            {
+                std::size_t best = PILE_NONE;
+                std::size_t empty = PILE_NONE;
+                unroll<Rules::NUM_FIELD_STACKS>([&](std::size_t i)
+                {
+                    const FieldStack<T> &dest = field[i];
+                    if (i == exclude)
+                    {
+                        return;
+                    }
+                    if (dest.num_cards() == 0)
+                    {
+                        if (empty == PILE_NONE)
+                        {
+                            empty = i;
+                        }
+                    }
+                    else if (stackable(dest, bottom) && (best == PILE_NONE || comp(dest.top_card(), field[best].top_card())))
+                    {
+                        best = i;
+                    }
+                });
+                return best != PILE_NONE ? best : (allowEmpty ? empty : PILE_NONE);
+            }
+
+            /**
+             * Clearing a run off a stack that has (depth) face-down cards under it. Held to what a score can hold, since the weights can be anything.
+             */
+            int reveal_score(std::size_t depth) const
+            {
+                const std::int64_t clamped = static_cast<std::int64_t>(std::min(depth, static_cast<std::size_t>(INT_MAX)));
+                const std::int64_t score = static_cast<std::int64_t>(weights.reveal) + static_cast<std::int64_t>(weights.revealDepth) * clamped;
+                return static_cast<int>(std::max<std::int64_t>(INT_MIN, std::min<std::int64_t>(INT_MAX, score)));
+            }
+
+            /**
+             * Picks the highest-scoring move available, the first one found on a tie, however low it scores.
+             * Leaves src as PILE_NONE if the only thing left is to draw.
+             */
+            Move choose_move() const
+            {
+                Move best;
+                auto offer = [&best](std::size_t src, std::size_t dest, std::size_t count, int score)
+                {
+                    if (best.src == PILE_NONE || score > best.score)
+                    {
+                        best.src = src;
+                        best.dest = dest;
+                        best.count = count;
+                        best.score = score;
+                    }
+                };
+
+                // A visible card can only be founded if it ties with the smallest card, wherever that one is.
+                const T *smallest = smallest_remaining();
+                const bool canFound = smallest != nullptr;
+
+                unroll<Rules::NUM_FIELD_STACKS>([&](std::size_t i)
+                {
+                    const FieldStack<T> &src = field[i];
+                    if (src.num_cards() == 0)
+                    {
+                        return;
+                    }
+                    if (canFound && !comp(*smallest, src.top_card()))
+                    {
+                        offer(i, PILE_FOUNDATION, 1, weights.foundFromField);
+                        return;
+                    }
+                    // Only whole runs are worth moving: the card under a partial run is never smaller than the run's top.
+                    const T &bottom = src.cards[src.num_cards() - src.faceUp];
+                    if (src.face_down() != 0)
+                    {
+                        const std::size_t dest = best_destination(bottom, i, true);
+                        if (dest != PILE_NONE)
+                        {
+                            offer(i, dest, src.faceUp, reveal_score(src.face_down()));
+                        }
+                    }
+                    else
+                    {
+                        // Merging a bare run onto another stack frees up an empty stack.
+                        const std::size_t dest = best_destination(bottom, i, false);
+                        if (dest != PILE_NONE)
+                        {
+                            offer(i, dest, src.faceUp, weights.merge);
+                        }
+                    }
+                });
+
+                // Without random access, only the last card drawn is in reach.
+                const std::size_t firstPlayable = (Rules::HAND_ALLOW_RANDOM_ACCESS || hand.empty()) ? 0 : hand.size() - 1;
+                for (std::size_t i = firstPlayable; i < hand.size(); ++i)
+                {
+                    if (canFound && !comp(*smallest, hand[i]))
+                    {
+                        offer(PILE_HAND, PILE_FOUNDATION, i, weights.foundFromHand);
+                        continue;
+                    }
+                    const std::size_t dest = best_destination(hand[i], PILE_NONE, true);
+                    if (dest != PILE_NONE)
+                    {
+                        offer(PILE_HAND, dest, i, field[dest].num_cards() != 0 ? weights.handToStack : weights.handToEmpty);
+                    }
+                }
+
+                return best;
+            }
+
+            /**
+             * Selects and performs a move in the game.
+             */
+            GameStatus try_make_move()
+            {
+                if (foundation.size() == total)
+                {
+                    return GAME_WIN;
+                }
+
+                const Move move = choose_move();
+
+                if (move.src == PILE_NONE)
+                {
+                    // A full pass through the deck without anything else to do means the game is stuck.
+                    const std::size_t cardsOutOfPlay = deck.num_cards() + hand.size();
+                    if (cardsOutOfPlay == 0 || stalledDraws > cardsOutOfPlay / Rules::NUM_CARDS_IN_HAND + 1)
+                    {
+                        return GAME_LOSS;
+                    }
+                    draw();
+                    ++stalledDraws;
+                    return GAME_PLAYING;
+                }
+                stalledDraws = 0;
+
+                if (move.src == PILE_HAND)
+                {
+                    T card = std::move(hand[move.count]);
+                    hand.erase(hand.begin() + static_cast<std::ptrdiff_t>(move.count));
+                    if (move.dest == PILE_FOUNDATION)
+                    {
+                        foundation.push_back(std::move(card));
+                    }
+                    else
+                    {
+                        field[move.dest].cards.push_back(std::move(card));
+                        ++field[move.dest].faceUp;
+                    }
+                    return GAME_PLAYING;
+                }
+
+                FieldStack<T> &src = field[move.src];
+                std::vector<T> &dest = move.dest == PILE_FOUNDATION ? foundation : field[move.dest].cards;
+                std::move(src.cards.end() - static_cast<std::ptrdiff_t>(move.count), src.cards.end(), std::back_inserter(dest));
+                src.cards.erase(src.cards.end() - static_cast<std::ptrdiff_t>(move.count), src.cards.end());
+                src.faceUp -= move.count;
+                if (move.dest != PILE_FOUNDATION)
+                {
+                    field[move.dest].faceUp += move.count;
+                }
+                reveal_if_needed(src);
+                return GAME_PLAYING;
+            }
+        };
+    }
+
+    namespace detail
+    {
+        /**
+         * Whether elements are cheap enough to deal as they are, copied afresh for every game.
+         * Anything else is dealt as positions into the range, so it is never copied and only moved once, after a win.
+         */
+        template <class T>
+        constexpr bool DEAL_BY_VALUE = std::is_trivially_copyable<T>::value && sizeof(T) <= sizeof(std::size_t);
+
+        /**
+         * Orders positions into a range by the elements at them. Stable breaks ties by position, so no two cards are equal.
+         */
+        template <class RandomIt, class Compare, bool Stable>
+        struct PositionCompare
+        {
+            RandomIt first;
+            Compare comp;
+
+            bool operator()(std::size_t a, std::size_t b) const
+            {
+                if constexpr (Stable)
+                {
+                    return comp(first[a], first[b]) || (!comp(first[b], first[a]) && a < b);
+                }
+                return comp(first[a], first[b]);
+            }
+        };
+
+        /**
+         * Deals a fresh copy of the positions 0 to (size) - 1 to every game.
+         */
+        class PositionDealer
+        {
+        public:
+            explicit PositionDealer(std::size_t size) : cards(size)
+            {
+                for (std::size_t i = 0; i < size; ++i)
+                {
+                    cards[i] = i;
+                }
+            }
+
+            std::vector<std::size_t> operator()() const
+            {
+                return cards;
+            }
+
+        private:
+            std::vector<std::size_t> cards;
+        };
+
+        /**
+         * Moves the elements of the range into the order (order) gives as positions, through one buffer.
+         */
+        template <class RandomIt>
+        void gather(RandomIt first, const std::vector<std::size_t> &order)
+        {
+            using T = typename std::iterator_traits<RandomIt>::value_type;
+
+            std::vector<T> sorted;
+            sorted.reserve(order.size());
+            for (const std::size_t position : order)
+            {
+                sorted.push_back(std::move(first[position]));
+            }
+            std::move(sorted.begin(), sorted.end(), first);
+        }
+
+        /**
+         * Plays up to GameRules::MAX_RETRIES games, stopping early once (cancelled) is raised.
+         * (deal) makes each game a fresh vector of cards, so they should be cheap to copy. The first win's foundation is handed to (won).
+         */
+        template <class GameRules, class Card, class CardCompare, class Deal, class Won>
+        bool play_games(Deal &&deal, CardCompare comp, const Weights &weights, const std::atomic<bool> *cancelled, Won &&won)
+        {
+            std::minstd_rand engine(std::random_device{}());
+            Game<Card, CardCompare, GameRules> game(std::move(comp), weights);
+
+            for (std::size_t i = 0; i < GameRules::MAX_RETRIES && !(cancelled && cancelled->load(std::memory_order_relaxed)); ++i)
+            {
+                game.setup(deal(), engine);
+                if (game.play(cancelled) == GAME_WIN)
+                {
+                    won(game.foundation_cards());
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Sorts [first, last) by playing up to GameRules::MAX_RETRIES games, stopping early once (cancelled) is raised.
+         */
+        template <class GameRules, class RandomIt, class Compare>
+        bool play_until_won(RandomIt first, RandomIt last, Compare comp, const Weights &weights, const std::atomic<bool> *cancelled)
+        {
+            using T = typename std::iterator_traits<RandomIt>::value_type;
+
+            if (last - first < 2)
+            {
+                return true;
+            }
+
+            if constexpr (DEAL_BY_VALUE<T>)
+            {
+                return play_games<GameRules, T>([first, last]()
+                                                { return std::vector<T>(first, last); },
+                                                std::move(comp), weights, cancelled, [first](std::vector<T> &foundation)
+                                                { std::move(foundation.begin(), foundation.end(), first); });
+            }
+            else
+            {
+                const PositionCompare<RandomIt, Compare, false> byPosition{first, std::move(comp)};
+                return play_games<GameRules, std::size_t>(PositionDealer(static_cast<std::size_t>(last - first)), byPosition, weights, cancelled,
+                                                          [first](const std::vector<std::size_t> &foundation)
+                                                          { gather(first, foundation); });
+            }
+        }
+    }
+
+    /**
+     * @brief Sorts [first, last) by playing Solitaire with it under a compile-time rule set.
+     *
+     * @tparam GameRules A Rules instantiation, such as KlondikeRules.
+     * @param weights How the player scores its moves, e.g. Weights::from a file solitaire-sort-bench --tune wrote.
+     * @return Whether a game was won within GameRules::MAX_RETRIES tries. The range is left untouched if every game was lost.
+     */
+    template <class GameRules, class RandomIt, class Compare>
+    bool solitaire_sort_with(RandomIt first, RandomIt last, Compare comp, const Weights &weights = Weights())
+    {
+        return detail::play_until_won<GameRules>(first, last, std::move(comp), weights, nullptr);
+    }
+
+    /**
+     * @brief Sorts [first, last) by playing Solitaire with it.
+     * Usable as a drop-in for std::sort, with the same requirements on the iterators, elements and comparator: move-only elements are fine,
+     * and anything bigger than a word or not trivially copyable is never copied.
+     *
+     * @param comp Strict weak ordering, as with std::sort.
+     * @return Whether a game was won within MAX_RETRIES tries. The range is left untouched if every game was lost.
+     */
+    template <class RandomIt, class Compare>
+    bool solitaire_sort(RandomIt first, RandomIt last, Compare comp)
+    {
+        return solitaire_sort_with<ClassicRules>(first, last, std::move(comp));
+    }
+
+    /**
+     * @brief Sorts [first, last) under a rule set picked at runtime.
+     * Goes through a table with one specialized engine per rule set, so the choice costs a single indirect call.
+     *
+     * @return Whether a game was won. False for a rule set that doesn't exist.
+     */
+    template <class RandomIt, class Compare = std::less<>>
+    bool solitaire_sort(RuleSet rules, RandomIt first, RandomIt last, Compare comp = Compare(), const Weights &weights = Weights())
+    {
+        using Sorter = bool (*)(RandomIt, RandomIt, Compare, const Weights &);
+        static constexpr Sorter sorters[NUM_RULE_SETS] = {
+            &solitaire_sort_with<ClassicRules, RandomIt, Compare>,
+            &solitaire_sort_with<KlondikeRules, RandomIt, Compare>,
+            &solitaire_sort_with<DrawOneRules, RandomIt, Compare>,
+        };
+        return rules < NUM_RULE_SETS && sorters[rules](first, last, std::move(comp), weights);
+    }
+
+    /**
+     * @brief Sorts [first, last) in ascending order by playing Solitaire with it.
+     */
+    template <class RandomIt>
+    bool solitaire_sort(RandomIt first, RandomIt last)
+    {
+        return solitaire_sort(first, last, std::less<>());
+    }
+
+    /**
+     * @brief Sorts [first, last) by a projection of each element, e.g. a key member of a struct.
+     */
+    template <class RandomIt, class Compare, class Projection>
+    bool solitaire_sort(RandomIt first, RandomIt last, Compare comp, Projection proj)
+    {
+        using T = typename std::iterator_traits<RandomIt>::value_type;
+        return solitaire_sort(first, last, [&](const T &a, const T &b)
+                              { return comp(proj(a), proj(b)); });
+    }
+
+    /**
+     * @brief Sorts [first, last) by playing Solitaire with it under a compile-time rule set, keeping equal elements in their input order.
+     * Every element is dealt as its position and ties are broken by position, so no two cards in the game are equal
+     * and the foundation comes out in stable order with no fix-up afterwards. Elements are only moved, once, after a win.
+     *
+     * @return Whether a game was won within GameRules::MAX_RETRIES tries. The range is left untouched if every game was lost.
+     */
+    template <class GameRules, class RandomIt, class Compare>
+    bool solitaire_stable_sort_with(RandomIt first, RandomIt last, Compare comp, const Weights &weights = Weights())
+    {
+        if (last - first < 2)
+        {
+            return true;
+        }
+
+        const detail::PositionCompare<RandomIt, Compare, true> byPosition{first, std::move(comp)};
+        return detail::play_games<GameRules, std::size_t>(detail::PositionDealer(static_cast<std::size_t>(last - first)), byPosition, weights, nullptr,
+                                                          [first](const std::vector<std::size_t> &foundation)
+                                                          { detail::gather(first, foundation); });
+    }
+
+    /**
+     * @brief Sorts [first, last) by playing Solitaire with it, keeping equal elements in their input order.
+     * Usable as a drop-in for std::stable_sort, with the same requirements on the iterators, elements and comparator.
+     *
+     * @return Whether a game was won within MAX_RETRIES tries. The range is left untouched if every game was lost.
+     */
+    template <class RandomIt, class Compare>
+    bool solitaire_stable_sort(RandomIt first, RandomIt last, Compare comp)
+    {
+        return solitaire_stable_sort_with<ClassicRules>(first, last, std::move(comp));
+    }
+
+    /**
+     * @brief Stable sort of [first, last) in ascending order by playing Solitaire with it.
+     */
+    template <class RandomIt>
+    bool solitaire_stable_sort(RandomIt first, RandomIt last)
+    {
+        return solitaire_stable_sort(first, last, std::less<>());
+    }
+
+    /**
+     * @brief Stable sort of [first, last) by a projection of each element, e.g. a key member of a struct.
+     */
+    template <class RandomIt, class Compare, class Projection>
+    bool solitaire_stable_sort(RandomIt first, RandomIt last, Compare comp, Projection proj)
+    {
+        using T = typename std::iterator_traits<RandomIt>::value_type;
+        return solitaire_stable_sort(first, last, [&](const T &a, const T &b)
+                                     { return comp(proj(a), proj(b)); });
+    }
+
+    /**
+     * @brief Calls off a solitaire_sort_async from any thread. Copies share one flag, so keep one and hand a copy to the sort.
+     */
+    class CancelToken
+    {
+    public:
+        CancelToken() : flag(std::make_shared<std::atomic<bool>>(false)) {}
+
+        void cancel() const
+        {
+            flag->store(true, std::memory_order_relaxed);
+        }
+
+        bool cancelled() const
+        {
+            return flag->load(std::memory_order_relaxed);
+        }
+
+        const std::atomic<bool> *get() const
+        {
+            return flag.get();
+        }
+
+    private:
+        std::shared_ptr<std::atomic<bool>> flag;
+    };
+
+    namespace detail
+    {
+        /**
+         * The threads every solitaire_sort_async shares. One is started whenever more sorts are waiting than threads are idle,
+         * up to ASYNC_THREADS, and from then on it sleeps until the next sort comes. Past that, sorts wait their turn, oldest first.
+         * The threads are joined at exit, once everything queued has run.
+         */
+        class AsyncPool
+        {
+        public:
+            static AsyncPool &instance()
+            {
+                static AsyncPool pool;
+                return pool;
+            }
+
+            void submit(std::function<void()> job)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push_back(std::move(job));
+                if (queue.size() > idle && threads.size() < ASYNC_THREADS)
+                {
+                    threads.emplace_back([this]()
+                                         { run(); });
+                }
+                queued.notify_one();
+            }
+
+            ~AsyncPool()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+                queued.notify_all();
+                for (std::thread &thread : threads)
+                {
+                    thread.join();
+                }
+            }
+
+        private:
+            std::mutex mutex;
+            std::condition_variable queued;
+            std::deque<std::function<void()>> queue;
+            std::vector<std::thread> threads;
+            std::size_t idle = 0;
+            bool stopping = false;
+
+            AsyncPool() = default;
+
+            void run()
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                for (;;)
+                {
+                    ++idle;
+                    queued.wait(lock, [this]()
+                                { return stopping || !queue.empty(); });
+                    --idle;
+                    if (queue.empty())
+                    {
+                        return;
+                    }
+                    std::function<void()> job = std::move(queue.front());
+                    queue.pop_front();
+                    lock.unlock();
+                    job();
+                    lock.lock();
+                }
+            }
+        };
+    }
+
+    /**
+     * @brief Sorts [first, last) under a compile-time rule set on a shared pool of threads, so the caller can get on with its I/O in the meantime.
+     * At most ASYNC_THREADS sorts run at once, however many are asked for; the rest wait their turn.
+     * The range has to stay valid, and be left alone, until the future is ready.
+     *
+     * @tparam GameRules A Rules instantiation, such as KlondikeRules. Its MAX_RETRIES is how many games are tried.
+     * @param token Raising it stops the sort at its next move, as a loss, with the range left as it was. Also skips a sort still waiting to start.
+     * @return Becomes whether a game was won, as with solitaire_sort_with.
+     */
+    template <class GameRules, class RandomIt, class Compare = std::less<>>
+    std::future<bool> solitaire_sort_async_with(RandomIt first, RandomIt last, Compare comp = Compare(), CancelToken token = CancelToken(),
+                                                const Weights &weights = Weights())
+    {
+        auto task = std::make_shared<std::packaged_task<bool()>>([first, last, comp, token, weights]()
+                                                                 { return detail::play_until_won<GameRules>(first, last, comp, weights, token.get()); });
+        std::future<bool> result = task->get_future();
+        detail::AsyncPool::instance().submit([task]()
+                                             { (*task)(); });
+        return result;
+    }
+
+    /**
+     * @brief Sorts [first, last) on a shared pool of threads, so the caller can get on with its I/O in the meantime.
+     * The range has to stay valid, and be left alone, until the future is ready.
+     *
+     * @param token Raising it stops the sort at its next move, as a loss, with the range left as it was.
+     * @return Becomes whether a game was won, as with solitaire_sort.
+     */
+    template <class RandomIt, class Compare = std::less<>>
+    std::future<bool> solitaire_sort_async(RandomIt first, RandomIt last, Compare comp = Compare(), CancelToken token = CancelToken())
+    {
+        return solitaire_sort_async_with<ClassicRules>(first, last, std::move(comp), std::move(token));
+    }
+
+    /**
+     * @brief Sorts [first, last) under a rule set picked at runtime, on the shared pool of threads.
+     *
+     * @return Becomes whether a game was won. Ready straight away, as false, for a rule set that doesn't exist.
+     */
+    template <class RandomIt, class Compare = std::less<>>
+    std::future<bool> solitaire_sort_async(RuleSet rules, RandomIt first, RandomIt last, Compare comp = Compare(), CancelToken token = CancelToken(),
+                                           const Weights &weights = Weights())
+    {
+        using Starter = std::future<bool> (*)(RandomIt, RandomIt, Compare, CancelToken, const Weights &);
+        static constexpr Starter starters[NUM_RULE_SETS] = {
+            &solitaire_sort_async_with<ClassicRules, RandomIt, Compare>,
+            &solitaire_sort_async_with<KlondikeRules, RandomIt, Compare>,
+            &solitaire_sort_async_with<DrawOneRules, RandomIt, Compare>,
+        };
+        if (rules >= NUM_RULE_SETS)
+        {
+            std::promise<bool> lost;
+            lost.set_value(false);
+            return lost.get_future();
+        }
+        return starters[rules](first, last, std::move(comp), std::move(token), weights);
+    }
+}